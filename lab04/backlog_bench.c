@@ -0,0 +1,448 @@
+// backlog_bench.c
+//
+// Mede o efeito do backlog do listen() com uma "tempestade" de conexões:
+// para cada valor de backlog, abre um listening socket (ou sobe o servidor
+// como processo filho), dispara milhares de connect() non-blocking de uma vez
+// e observa o que acontece com as filas do kernel:
+//
+//   - fila de accept: conexões completas esperando accept(); o Linux aceita
+//     até backlog+1 e, cheia, descarta SYNs novos (o cliente retransmite
+//     depois de ~1s) e o ACK final do handshake
+//   - fila de SYN: quando o ACK final é descartado o cliente já se vê
+//     conectado, mas o servidor continua em SYN_RECV ("meio abertas")
+//
+// Substitui teste.sh/server_script.sh (xargs + sleep + ss): cada rodada
+// leva ~timeout ms em vez de dezenas de segundos e mede direto nos sockets.
+//
+// Uso: ./backlog_bench [chave=valor ...]
+//   backlog=A-B       valores de backlog da varredura (padrão 0-10)
+//   conns=N           connects simultâneos por rodada (padrão 1000)
+//   timeout=MS        quanto esperar os connects (padrão 1000)
+//   accept_delay=MS   servidor interno: -1 não aceita durante a rodada (mede
+//                     só a fila), 0 aceita o mais rápido possível, >0 um
+//                     accept a cada MS ms (padrão -1)
+//   server=ARQ        em vez do servidor interno, roda "ARQ porta backlog
+//                     sleep" como filho (ex.: server=./server)
+//   port=P            porta do servidor filho (padrão 9871)
+//   sleep=S           sleep_time passado ao servidor filho (padrão 5)
+//   out=ARQ           CSV de saída (padrão resultados_backlog.csv)
+//
+// Compile: gcc -Wall -O2 -pthread -o backlog_bench backlog_bench.c
+
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// estado de cada connect da rodada
+enum { PEND, ESTAB, REFUSED, FAILED };
+
+struct storm_conn {
+  int fd;
+  int state;
+  long long start_ns;     // connect() chamado
+  long long estab_ns;     // handshake completo do lado do cliente
+  long long accept_ns;    // accept() do servidor interno (0 = não aceita)
+};
+
+static struct {
+  int from, to;
+  int conns;
+  int timeout_ms;
+  int accept_delay_ms;
+  const char* server;
+  int port;
+  int sleep_time;
+  const char* out;
+} opt = { 0, 10, 1000, 1000, -1, NULL, 9871, 5, "resultados_backlog.csv" };
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ms(int ms) {
+  struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+  nanosleep(&ts, NULL);
+}
+
+// le_proc: primeiro inteiro de um arquivo do /proc (-1 se não existir)
+static long le_proc(const char* path) {
+  long v = -1;
+  FILE* f = fopen(path, "r");
+  if (f) {
+    if (fscanf(f, "%ld", &v) != 1) v = -1;
+    fclose(f);
+  }
+  return v;
+}
+
+// ---------------- servidor interno ----------------
+//
+// Listening socket no próprio processo e uma thread que aceita conforme
+// accept_delay. O accept é casado com o connect pela porta local do
+// cliente, o que dá o tempo de cada conexão na fila de accept.
+
+struct server {
+  int listenfd;
+  int port;
+  volatile int storm_over;      // a rodada acabou: drena o que sobrou
+  struct storm_conn* conns;
+  int* by_port;                 // porta local do cliente -> índice em conns
+  int* accepted_fds;
+  int naccepted;
+  pthread_t tid;
+};
+
+// drain: aceite do fim da rodada; conta em naccepted mas não é um accept()
+// medido, então não marca accept_ns
+static int server_accept_one(struct server* s, int flags, int drain) {
+  struct sockaddr_in cli;
+  socklen_t len = sizeof(cli);
+  int fd = accept4(s->listenfd, (struct sockaddr*)&cli, &len, flags);
+  if (fd < 0) return -1;
+  int i = s->by_port[ntohs(cli.sin_port)];
+  if (!drain && i >= 0 && s->conns[i].accept_ns == 0) s->conns[i].accept_ns = now_ns();
+  // mantém aberta até o fim da rodada, como o servidor do lab04 durante o sleep
+  s->accepted_fds[s->naccepted++] = fd;
+  return fd;
+}
+
+static void* server_thread(void* arg) {
+  struct server* s = arg;
+  while (!s->storm_over) {
+    if (opt.accept_delay_ms < 0) {
+      sleep_ms(1);
+      continue;
+    }
+    if (server_accept_one(s, 0, 0) < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) break;
+      sleep_ms(1);
+      continue;
+    }
+    if (opt.accept_delay_ms > 0) sleep_ms(opt.accept_delay_ms);
+  }
+  return NULL;
+}
+
+static int server_start(struct server* s, int backlog) {
+  s->listenfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (s->listenfd < 0) return -1;
+  int one = 1;
+  setsockopt(s->listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t len = sizeof(addr);
+  if (bind(s->listenfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+      listen(s->listenfd, backlog) < 0 ||
+      getsockname(s->listenfd, (struct sockaddr*)&addr, &len) < 0) {
+    close(s->listenfd);
+    return -1;
+  }
+  s->port = ntohs(addr.sin_port);
+  s->storm_over = 0;
+  s->naccepted = 0;
+  return pthread_create(&s->tid, NULL, server_thread, s);
+}
+
+// server_queue: conexões completas esperando accept() agora (TCP_INFO do
+// listening socket: tcpi_unacked é a fila atual, tcpi_sacked o limite)
+static int server_queue(struct server* s, int* limit) {
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+  if (getsockopt(s->listenfd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) return -1;
+  if (limit) *limit = ti.tcpi_sacked;
+  return ti.tcpi_unacked;
+}
+
+static void server_stop(struct server* s) {
+  s->storm_over = 1;
+  pthread_join(s->tid, NULL);
+  while (server_accept_one(s, SOCK_NONBLOCK, 1) >= 0) {}   // drena a fila
+  for (int i = 0; i < s->naccepted; i++) close(s->accepted_fds[i]);
+  close(s->listenfd);
+}
+
+// ---------------- servidor filho ----------------
+
+// escutando: a porta está em LISTEN no /proc/net/tcp?
+static int escutando(int port) {
+  FILE* f = fopen("/proc/net/tcp", "r");
+  if (f == NULL) return 0;
+  char line[256];
+  unsigned local_port, state;
+  int found = 0;
+  while (!found && fgets(line, sizeof(line), f))
+    if (sscanf(line, " %*d: %*x:%x %*x:%*x %x", &local_port, &state) == 2)
+      found = local_port == (unsigned)port && state == 0x0A;
+  fclose(f);
+  return found;
+}
+
+static pid_t child_start(int backlog) {
+  fflush(stdout);   // o filho não pode herdar (e repetir) o buffer
+  pid_t pid = fork();
+  if (pid == 0) {
+    char port[16], bl[16], sl[16];
+    snprintf(port, sizeof(port), "%d", opt.port);
+    snprintf(bl, sizeof(bl), "%d", backlog);
+    snprintf(sl, sizeof(sl), "%d", opt.sleep_time);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+    execl(opt.server, opt.server, port, bl, sl, (char*)NULL);
+    perror(opt.server);
+    _exit(127);
+  }
+  if (pid < 0) return -1;
+  // espera o listen() sem gastar uma conexão da fila com um connect de teste
+  for (int i = 0; i < 2000 && !escutando(opt.port); i++) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) return -1;
+    sleep_ms(1);
+  }
+  return pid;
+}
+
+static void child_stop(pid_t pid) {
+  kill(pid, SIGTERM);
+  for (int i = 0; i < 100; i++) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) return;
+    sleep_ms(1);
+  }
+  kill(pid, SIGKILL);
+  waitpid(pid, NULL, 0);
+}
+
+// ---------------- tempestade de connects ----------------
+
+struct result {
+  int estab, refused, failed, pending, accepted, half_open, queue, queue_limit;
+  long long connect_p50, connect_max, accept_p50, accept_max;   // us
+};
+
+static int cmp_ll(const void* a, const void* b) {
+  long long x = *(const long long*)a, y = *(const long long*)b;
+  return (x > y) - (x < y);
+}
+
+// p50_max: mediana e máximo (us) de v[0..n)
+static void p50_max(long long* v, int n, long long* p50, long long* max) {
+  *p50 = *max = -1;
+  if (n == 0) return;
+  qsort(v, n, sizeof(*v), cmp_ll);
+  *p50 = v[n / 2] / 1000;
+  *max = v[n - 1] / 1000;
+}
+
+static void storm(struct storm_conn* conns, int port, struct server* srv, struct result* r) {
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  int epfd = epoll_create1(0);
+  int pending = 0;
+  memset(r, 0, sizeof(*r));
+
+  // todos os connects saem de uma vez, antes de olhar qualquer resultado
+  for (int i = 0; i < opt.conns; i++) {
+    struct storm_conn* c = &conns[i];
+    memset(c, 0, sizeof(*c));
+    c->state = FAILED;
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (c->fd < 0) continue;
+    // RST no close: sem TIME_WAIT acumulando portas entre rodadas
+    struct linger lg = { 1, 0 };
+    setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    // a porta local sai antes do connect para o servidor casar o accept
+    struct sockaddr_in local = { .sin_family = AF_INET };
+    socklen_t len = sizeof(local);
+    local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(c->fd, (struct sockaddr*)&local, sizeof(local)) == 0 &&
+        getsockname(c->fd, (struct sockaddr*)&local, &len) == 0 && srv)
+      srv->by_port[ntohs(local.sin_port)] = i;
+
+    c->start_ns = now_ns();
+    if (connect(c->fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+      c->state = ESTAB;
+      c->estab_ns = now_ns();
+    } else if (errno == EINPROGRESS) {
+      c->state = PEND;
+      struct epoll_event ev = { .events = EPOLLOUT, .data.u32 = i };
+      epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+      pending++;
+    } else {
+      c->state = errno == ECONNREFUSED ? REFUSED : FAILED;
+    }
+  }
+
+  long long deadline = now_ns() + opt.timeout_ms * 1000000LL;
+  struct epoll_event events[512];
+  while (pending > 0) {
+    long long left = (deadline - now_ns()) / 1000000;
+    if (left <= 0) break;
+    int n = epoll_wait(epfd, events, 512, (int)left);
+    for (int k = 0; k < n; k++) {
+      struct storm_conn* c = &conns[events[k].data.u32];
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      c->state = err == 0 ? ESTAB : err == ECONNREFUSED ? REFUSED : FAILED;
+      c->estab_ns = now_ns();
+      epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+      pending--;
+    }
+  }
+  close(epfd);
+
+  // fila de accept no fim da rodada, antes do servidor drenar
+  if (srv) {
+    r->queue = server_queue(srv, &r->queue_limit);
+    server_stop(srv);
+  }
+
+  long long* connect_t = malloc(opt.conns * sizeof(*connect_t));
+  long long* accept_t = malloc(opt.conns * sizeof(*accept_t));
+  int nc = 0, na = 0;
+  for (int i = 0; i < opt.conns; i++) {
+    struct storm_conn* c = &conns[i];
+    switch (c->state) {
+      case ESTAB:   r->estab++; connect_t[nc++] = c->estab_ns - c->start_ns; break;
+      case REFUSED: r->refused++; break;
+      case FAILED:  r->failed++; break;
+      default:      r->pending++; break;
+    }
+    if (c->accept_ns) accept_t[na++] = c->accept_ns - c->start_ns;
+    if (c->fd >= 0) close(c->fd);
+  }
+  r->accepted = srv ? srv->naccepted : -1;
+  // o cliente terminou o handshake mas o servidor não tem a conexão:
+  // o ACK final foi descartado com a fila de accept cheia (SYN_RECV)
+  r->half_open = srv ? r->estab - srv->naccepted : -1;
+  if (r->half_open < 0 && srv) r->half_open = 0;
+  p50_max(connect_t, nc, &r->connect_p50, &r->connect_max);
+  p50_max(accept_t, na, &r->accept_p50, &r->accept_max);
+  free(connect_t);
+  free(accept_t);
+}
+
+// ---------------- main ----------------
+
+static int parse_options(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    char* eq = strchr(argv[i], '=');
+    if (eq == NULL) {
+      fprintf(stderr, "opção inválida '%s' (esperado chave=valor)\n", argv[i]);
+      return -1;
+    }
+    *eq = '\0';
+    const char* v = eq + 1;
+    if (strcmp(argv[i], "backlog") == 0) {
+      if (sscanf(v, "%d-%d", &opt.from, &opt.to) == 1) opt.to = opt.from;
+    }
+    else if (strcmp(argv[i], "conns") == 0) opt.conns = atoi(v);
+    else if (strcmp(argv[i], "timeout") == 0) opt.timeout_ms = atoi(v);
+    else if (strcmp(argv[i], "accept_delay") == 0) opt.accept_delay_ms = atoi(v);
+    else if (strcmp(argv[i], "server") == 0) opt.server = v;
+    else if (strcmp(argv[i], "port") == 0) opt.port = atoi(v);
+    else if (strcmp(argv[i], "sleep") == 0) opt.sleep_time = atoi(v);
+    else if (strcmp(argv[i], "out") == 0) opt.out = v;
+    else {
+      fprintf(stderr, "opção desconhecida '%s'\n", argv[i]);
+      return -1;
+    }
+  }
+  if (opt.conns < 1 || opt.from < 0 || opt.to < opt.from) {
+    fprintf(stderr, "valores inválidos\n");
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (parse_options(argc, argv) < 0) return 1;
+
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)opt.conns * 2 + 64) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  struct storm_conn* conns = calloc(opt.conns, sizeof(*conns));
+  struct server srv;
+  memset(&srv, 0, sizeof(srv));
+  srv.conns = conns;
+  srv.by_port = malloc(65536 * sizeof(int));
+  srv.accepted_fds = malloc(opt.conns * sizeof(int));
+  FILE* csv = fopen(opt.out, "w");
+  if (conns == NULL || srv.by_port == NULL || srv.accepted_fds == NULL || csv == NULL) {
+    perror(csv ? "malloc" : opt.out);
+    return 1;
+  }
+
+  printf("Teste de backlog (conns=%d, timeout=%dms, servidor=%s, accept_delay=%d)\n",
+         opt.conns, opt.timeout_ms, opt.server ? opt.server : "interno", opt.accept_delay_ms);
+  printf("somaxconn=%ld tcp_max_syn_backlog=%ld tcp_syncookies=%ld tcp_abort_on_overflow=%ld\n\n",
+         le_proc("/proc/sys/net/core/somaxconn"), le_proc("/proc/sys/net/ipv4/tcp_max_syn_backlog"),
+         le_proc("/proc/sys/net/ipv4/tcp_syncookies"), le_proc("/proc/sys/net/ipv4/tcp_abort_on_overflow"));
+  printf("%-7s | %6s %6s %6s %6s | %6s %6s %6s | %10s %10s | %10s %10s\n",
+         "BACKLOG", "estab", "recus", "tmout", "falha", "fila", "aceit", "meio", "conn p50", "conn max",
+         "acc p50", "acc max");
+
+  fprintf(csv, "backlog,conexoes,estabelecidas,recusadas,timeout,falhas,fila_accept,aceitas,meio_abertas,"
+               "connect_p50_us,connect_max_us,accept_p50_us,accept_max_us\n");
+
+  for (int backlog = opt.from; backlog <= opt.to; backlog++) {
+    struct result r;
+    memset(srv.by_port, -1, 65536 * sizeof(int));
+    if (opt.server) {
+      pid_t pid = child_start(backlog);
+      if (pid < 0) {
+        fprintf(stderr, "backlog %d: servidor %s não subiu na porta %d\n", backlog, opt.server, opt.port);
+        continue;
+      }
+      storm(conns, opt.port, NULL, &r);
+      child_stop(pid);
+      r.queue = r.accepted = r.half_open = -1;
+    } else {
+      if (server_start(&srv, backlog) < 0) {
+        perror("servidor interno");
+        return 1;
+      }
+      storm(conns, srv.port, &srv, &r);
+    }
+
+    printf("%-7d | %6d %6d %6d %6d | %6d %6d %6d | %10lld %10lld | %10lld %10lld\n",
+           backlog, r.estab, r.refused, r.pending, r.failed, r.queue, r.accepted, r.half_open,
+           r.connect_p50, r.connect_max, r.accept_p50, r.accept_max);
+    fprintf(csv, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%lld,%lld,%lld,%lld\n",
+            backlog, opt.conns, r.estab, r.refused, r.pending, r.failed, r.queue, r.accepted,
+            r.half_open, r.connect_p50, r.connect_max, r.accept_p50, r.accept_max);
+    fflush(csv);
+  }
+
+  fclose(csv);
+  printf("\nResultados salvos em: %s (tempos em us; -1 = não medido)\n", opt.out);
+  free(conns);
+  free(srv.by_port);
+  free(srv.accepted_fds);
+  return 0;
+}
@@ -0,0 +1,589 @@
+/* bench_http.c
+ *
+ * Micro-benchmarks das rotinas internas do server_http.c. O arquivo do
+ * servidor é incluído inteiro (sem o main), então os números medem
+ * exatamente o código que roda no servidor.
+ *
+ *  - parser: http_parse() contra o eh_requisicao_get() original (dois
+ *            strstr sobre o buffer inteiro)
+ *  - scan:   varredura de fim de headers e de ':' em cada implementação
+ *            (escalar, SSE4.2, AVX2) contra strstr/strpbrk, em bytes/ciclo
+ *  - poll:   vetor de pollfd do modo 2 (compacto, swap-remove) contra o
+ *            anterior (busca linear de slot livre, buracos com fd = -1),
+ *            com 10k conexões simuladas por eventfd
+ *  - udp:    caminho UDP do modo 3 em loopback, em pacotes/s, com e sem
+ *            offload (UDP_SEGMENT/UDP_GRO)
+ *  - paths:  file_rel_path() aceita os paths normais e recusa os que
+ *            sairiam do root (".." e segmentos vazios); sai com 1 se errar
+ *
+ * Uso: ./bench_http [parser|scan|poll|udp|paths]   (sem argumento roda todos)
+ *
+ * Compile: gcc -Wall -O2 -pthread -o bench_http bench_http.c
+ *
+ */
+
+#define SERVER_HTTP_NO_MAIN
+#include "server_http.c"
+
+#include <sys/eventfd.h>
+
+/* ---------- utilidades ---------- */
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* impede o compilador de descartar o resultado medido */
+static volatile long sink;
+
+/* esconde o valor do compilador, para que chamadas sem efeito colateral
+ * (strstr) não sejam tiradas de dentro do laço */
+#define OPAQUE(p) __asm__ volatile("" : "+r"(p))
+
+/* cycles: contador de ciclos (TSC) quando existe; senão nanossegundos */
+static inline unsigned long long cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/* ---------- parser ---------- */
+
+/* versão original do server_http.c (Exercício 5), mantida como referência */
+static int eh_requisicao_get_strstr(const char* request) {
+    const char* get_http_1   = "GET / HTTP/1.0";
+    const char* get_http_1_1 = "GET / HTTP/1.1";
+    return (request && (strstr(request, get_http_1) != NULL || strstr(request, get_http_1_1) != NULL));
+}
+
+static const char* parser_inputs[][2] = {
+    { "client_http", "GET / HTTP/1.0\r\n"
+                     "Host: teste\r\n"
+                     "\r\n" },
+    { "curl",        "GET / HTTP/1.1\r\n"
+                     "Host: 127.0.0.1:8080\r\n"
+                     "User-Agent: curl/7.88.1\r\n"
+                     "Accept: */*\r\n"
+                     "\r\n" },
+    { "browser",     "GET / HTTP/1.1\r\n"
+                     "Host: localhost:8080\r\n"
+                     "Connection: keep-alive\r\n"
+                     "Cache-Control: max-age=0\r\n"
+                     "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\", \"Not=A?Brand\";v=\"99\"\r\n"
+                     "sec-ch-ua-mobile: ?0\r\n"
+                     "sec-ch-ua-platform: \"Linux\"\r\n"
+                     "Upgrade-Insecure-Requests: 1\r\n"
+                     "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+                     "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+                     "Sec-Fetch-Site: none\r\n"
+                     "Sec-Fetch-Mode: navigate\r\n"
+                     "Sec-Fetch-User: ?1\r\n"
+                     "Sec-Fetch-Dest: document\r\n"
+                     "Accept-Encoding: gzip, deflate, br\r\n"
+                     "Accept-Language: pt-BR,pt;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+                     "\r\n" },
+};
+
+static void bench_parser(void) {
+    const long iters = 2000000;
+    printf("== parser (%ld iterações) ==\n", iters);
+    printf("%-12s %6s %16s %16s %16s\n", "request", "bytes", "strstr ns/req", "http_parse ns/req", "parse em 3 partes");
+
+    for (size_t k = 0; k < sizeof(parser_inputs) / sizeof(parser_inputs[0]); k++) {
+        const char* name = parser_inputs[k][0];
+        const char* req = parser_inputs[k][1];
+        size_t len = strlen(req);
+        long acc = 0;
+
+        double t0 = now_sec();
+        for (long i = 0; i < iters; i++) {
+            OPAQUE(req);
+            acc += eh_requisicao_get_strstr(req);
+        }
+        double t_old = now_sec() - t0;
+
+        struct http_parser p;
+        t0 = now_sec();
+        for (long i = 0; i < iters; i++) {
+            OPAQUE(req);
+            http_parser_init(&p);
+            acc += http_parse(&p, req, len) == HTTP_OK && route_find(req, &p.req, HTTP_OK)->status == 200;
+        }
+        double t_new = now_sec() - t0;
+
+        /* mesmo request chegando em três leituras, retomando o parser */
+        t0 = now_sec();
+        for (long i = 0; i < iters; i++) {
+            OPAQUE(req);
+            http_parser_init(&p);
+            http_parse(&p, req, len / 3);
+            http_parse(&p, req, 2 * len / 3);
+            acc += http_parse(&p, req, len) == HTTP_OK;
+        }
+        double t_split = now_sec() - t0;
+        sink = acc;
+
+        printf("%-12s %6zu %16.1f %16.1f %16.1f\n", name, len,
+               t_old * 1e9 / iters, t_new * 1e9 / iters, t_split * 1e9 / iters);
+    }
+    printf("\n");
+}
+
+/* ---------- scan ---------- */
+
+/* bloco de headers de 4 KB cujo fim está nos últimos bytes (pior caso) */
+static char* make_header_block(size_t size) {
+    char* buf = malloc(size + 1);
+    size_t n = (size_t)snprintf(buf, size + 1, "GET / HTTP/1.1\r\n");
+    int k = 0;
+    while (n + 64 < size)
+        n += (size_t)snprintf(buf + n, size + 1 - n, "X-Header-%03d: %.*s\r\n", k++, 40,
+                              "valor-de-teste-valor-de-teste-valor-de-teste");
+    while (n < size - 2) buf[n++] = 'x';
+    buf[n++] = '\r';
+    buf[n++] = '\n';
+    buf[n] = '\0';
+    /* a última linha vira a linha vazia */
+    memcpy(buf + n - 4, "\r\n\r\n", 4);
+    return buf;
+}
+
+typedef size_t (*scan_bench_fn)(const char*, size_t);
+
+static size_t strstr_header_end(const char* buf, size_t len) {
+    (void)len;
+    const char* p = strstr(buf, "\r\n\r\n");
+    return p ? (size_t)(p - buf) + 4 : 0;
+}
+
+static size_t strpbrk_delims(const char* buf, size_t len) {
+    const char* p = strpbrk(buf, ":\r\n");
+    return p ? (size_t)(p - buf) : len;
+}
+
+/* bytes_per_cycle: quantos bytes fn varre por ciclo sobre buf */
+static double bytes_per_cycle(scan_bench_fn fn, const char* buf, size_t len, long iters) {
+    long acc = 0;
+    unsigned long long t0 = cycles();
+    for (long i = 0; i < iters; i++) {
+        OPAQUE(buf);
+        acc += fn(buf, len);
+    }
+    unsigned long long t = cycles() - t0;
+    sink = acc;
+    return (double)len * iters / (double)t;
+}
+
+static void bench_scan(void) {
+    const long iters = 200000;
+    const size_t size = 4096;
+    char* block = make_header_block(size);
+    /* sem ':' nem CR/LF: a busca de delimitadores percorre tudo */
+    char* plain = malloc(size + 1);
+    memset(plain, 'a', size);
+    plain[size] = '\0';
+
+    printf("== scan (%zu bytes, %ld iterações; bytes/ciclo, maior é melhor) ==\n", size, iters);
+    printf("%-10s %14s %14s\n", "impl", "header_end", "delims");
+    printf("%-10s %14.2f %14.2f\n", "strstr", bytes_per_cycle(strstr_header_end, block, size, iters),
+           bytes_per_cycle(strpbrk_delims, plain, size, iters));
+    for (int i = 0; i < scan_nimpls; i++) {
+        if (!scan_impls[i].supported()) {
+            printf("%-10s %14s %14s\n", scan_impls[i].name, "n/d", "n/d");
+            continue;
+        }
+        if (scan_impls[i].header_end(block, size) != size) {
+            printf("%-10s resultado errado!\n", scan_impls[i].name);
+            continue;
+        }
+        printf("%-10s %14.2f %14.2f\n", scan_impls[i].name,
+               bytes_per_cycle(scan_impls[i].header_end, block, size, iters),
+               bytes_per_cycle(scan_impls[i].delims, plain, size, iters));
+    }
+
+    /* efeito no parser inteiro: request de navegador com cada implementação */
+    const char* req = parser_inputs[2][1];
+    size_t len = strlen(req);
+    const struct scan_impl* saved = scan;
+    printf("\nhttp_parse (request \"%s\", %zu bytes):\n", parser_inputs[2][0], len);
+    for (int i = 0; i < scan_nimpls; i++) {
+        if (!scan_impls[i].supported()) continue;
+        scan = &scan_impls[i];
+        struct http_parser p;
+        long acc = 0;
+        unsigned long long t0 = cycles();
+        for (long k = 0; k < iters * 10; k++) {
+            OPAQUE(req);
+            http_parser_init(&p);
+            acc += http_parse(&p, req, len);
+        }
+        unsigned long long t = cycles() - t0;
+        sink = acc;
+        printf("  %-8s %8.1f ciclos/req %6.2f bytes/ciclo\n", scan->name,
+               (double)t / (iters * 10), (double)len * iters * 10 / t);
+    }
+    scan = saved;
+    printf("\n");
+    free(block);
+    free(plain);
+}
+
+/* ---------- poll ---------- */
+
+/* vetor de pollfd do modo 2 antes do swap-remove, mantido como referência:
+ * slot livre achado por varredura a partir de 1, fd = -1 no fechamento e
+ * maxi que nunca diminui */
+struct poll_linear {
+    struct pollfd* fds;
+    int maxi;
+    int cap;
+};
+
+static void linear_add(struct poll_linear* pl, struct conn* c) {
+    int i;
+    for (i = 1; i < pl->cap; i++) {
+        if (pl->fds[i].fd < 0) break;
+    }
+    if (i == pl->cap) {
+        pl->fds = realloc(pl->fds, 2 * pl->cap * sizeof(struct pollfd));
+        for (int k = pl->cap; k < 2 * pl->cap; k++) pl->fds[k].fd = -1;
+        pl->cap *= 2;
+    }
+    c->slot = i;
+    pl->fds[i].fd = c->fd;
+    pl->fds[i].events = POLLRDNORM;
+    pl->fds[i].revents = 0;
+    if (i > pl->maxi) pl->maxi = i;
+}
+
+/* as duas versões lado a lado, com as mesmas conexões sorteadas */
+struct poll_bench {
+    int compact;                /* 1 = struct poll_set do servidor */
+    struct poll_set ps;
+    struct poll_linear pl;
+    struct conn_table table;
+    struct conn** live;         /* conexões abertas, para o sorteio */
+    int nlive;
+    unsigned seed;
+};
+
+static void pb_init(struct poll_bench* b, int compact, int n) {
+    memset(b, 0, sizeof(*b));
+    b->compact = compact;
+    b->ps.fds = malloc(64 * sizeof(struct pollfd));
+    b->ps.n = 1;
+    b->ps.cap = 64;
+    b->pl.fds = malloc(64 * sizeof(struct pollfd));
+    b->pl.cap = 64;
+    for (int i = 0; i < 64; i++) b->pl.fds[i].fd = -1;
+    /* o slot 0 seria o listenfd; aqui fica sem eventos */
+    b->ps.fds[0] = b->pl.fds[0] = (struct pollfd){ .fd = -1 };
+    conn_table_init(&b->table, n);
+    b->live = malloc(n * sizeof(*b->live));
+    b->seed = 12345;
+}
+
+static void pb_open(struct poll_bench* b) {
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct conn* c = fd >= 0 ? conn_new(fd, NULL, &b->table) : NULL;
+    if (c == NULL) {
+        perror("eventfd/conn_new");
+        exit(1);
+    }
+    if (b->compact) poll_add(&b->ps, c);
+    else linear_add(&b->pl, c);
+    b->live[b->nlive++] = c;
+}
+
+/* pb_close: fecha a k-ésima conexão aberta, na ordem que o servidor usa */
+static void pb_close(struct poll_bench* b, int k) {
+    struct conn* c = b->live[k];
+    int slot = c->slot;
+    conn_free(c);
+    if (b->compact) poll_remove(&b->ps, &b->table, slot);
+    else b->pl.fds[slot].fd = -1;
+    b->live[k] = b->live[--b->nlive];
+}
+
+/* pb_round: acorda active conexões sorteadas, chama poll() e trata o que
+ * ficou pronto como o laço do modo 2 faria; devolve os prontos */
+static int pb_round(struct poll_bench* b, int active) {
+    uint64_t v = 1;
+    for (int a = 0; a < active; a++) {
+        if (write(b->live[rand_r(&b->seed) % b->nlive]->fd, &v, sizeof(v)) < 0) perror("write");
+    }
+    int ready = 0;
+    if (b->compact) {
+        if (poll(b->ps.fds, b->ps.n, 0) < 0) perror("poll");
+        for (int i = 1; i < b->ps.n; i++) {
+            if (b->ps.fds[i].revents == 0) continue;
+            if (read(b->ps.fds[i].fd, &v, sizeof(v)) == sizeof(v)) ready++;
+        }
+    } else {
+        if (poll(b->pl.fds, b->pl.maxi + 1, 0) < 0) perror("poll");
+        for (int i = 1; i <= b->pl.maxi; i++) {
+            if (b->pl.fds[i].fd < 0 || b->pl.fds[i].revents == 0) continue;
+            if (read(b->pl.fds[i].fd, &v, sizeof(v)) == sizeof(v)) ready++;
+        }
+    }
+    return ready;
+}
+
+static int pb_nfds(const struct poll_bench* b) {
+    return b->compact ? b->ps.n : b->pl.maxi + 1;
+}
+
+/* pb_run: as três fases para uma versão; t[] recebe µs por operação e
+ * nfds[] o tamanho do vetor entregue ao poll() no fim de cada fase */
+static void pb_run(int compact, int n, int rounds, double t[3], int nfds[3]) {
+    struct poll_bench b;
+    pb_init(&b, compact, n);
+
+    /* abre: n accepts seguidos */
+    double t0 = now_sec();
+    for (int i = 0; i < n; i++) pb_open(&b);
+    t[0] = (now_sec() - t0) * 1e6 / n;
+    nfds[0] = pb_nfds(&b);
+
+    /* rotatividade: por rodada 16 conexões ativas, 16 fecham e 16 abrem */
+    long acc = 0;
+    t0 = now_sec();
+    for (int r = 0; r < rounds; r++) {
+        acc += pb_round(&b, 16);
+        for (int k = 0; k < 16; k++) pb_close(&b, rand_r(&b.seed) % b.nlive);
+        for (int k = 0; k < 16; k++) pb_open(&b);
+    }
+    t[1] = (now_sec() - t0) * 1e6 / rounds;
+    nfds[1] = pb_nfds(&b);
+
+    /* esvazia: 90% fecham (sorteadas) e o laço segue com o resto */
+    while (b.nlive > n / 10) pb_close(&b, rand_r(&b.seed) % b.nlive);
+    t0 = now_sec();
+    for (int r = 0; r < rounds; r++) acc += pb_round(&b, 16);
+    t[2] = (now_sec() - t0) * 1e6 / rounds;
+    nfds[2] = pb_nfds(&b);
+    sink = acc;
+
+    while (b.nlive > 0) pb_close(&b, b.nlive - 1);
+    free(b.ps.fds);
+    free(b.pl.fds);
+    free(b.table.by_fd);
+    free(b.live);
+}
+
+static void bench_poll(void) {
+    const int n = 10000, rounds = 2000;
+    struct rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t)n + 64) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    double lin[3], cmp[3];
+    int lin_n[3], cmp_n[3];
+    pb_run(0, n, rounds, lin, lin_n);
+    pb_run(1, n, rounds, cmp, cmp_n);
+
+    static const char* phases[] = { "abre (µs/accept)", "rotatividade (µs/rodada)",
+                                    "10% restantes (µs/rodada)" };
+    printf("== poll (%d conexões, %d rodadas de 16 ativas; menor é melhor) ==\n", n, rounds);
+    printf("%-26s %12s %8s %12s %8s\n", "fase", "linear", "nfds", "compacto", "nfds");
+    for (int i = 0; i < 3; i++)
+        printf("%-26s %12.2f %8d %12.2f %8d\n", phases[i], lin[i], lin_n[i], cmp[i], cmp_n[i]);
+    printf("\n");
+}
+
+/* ---------- udp ---------- */
+
+/* O servidor é um udp_engine numa thread (udp_worker) em 127.0.0.1; o
+ * cliente manda janelas de UDP_WINDOW requests pequenos e espera as
+ * respostas antes da próxima. Com offload os dois lados usam GSO no envio
+ * e GRO na leitura (no loopback o kernel entrega a mensagem GSO inteira a
+ * um socket com UDP_GRO, sem cortar), sem offload é um datagrama por
+ * entrada de sendmmsg/recvmmsg. */
+
+#define UDP_WINDOW 256
+#define UDP_REQ_LEN 32
+
+static int udp_bench_socket(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 4 << 20;
+    if (fd < 0) {
+        perror("socket udp");
+        exit(1);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    return fd;
+}
+
+/* udp_bench_server: sobe um udp_engine numa thread e devolve o endereço */
+static struct sockaddr_in udp_bench_server(void) {
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    socklen_t len = sizeof(addr);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = udp_bench_socket();
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        getsockname(fd, (struct sockaddr*)&addr, &len) < 0) {
+        perror("bind udp");
+        exit(1);
+    }
+    struct udp_engine* u = malloc(sizeof(*u));
+    udp_engine_init(u, fd, 0, "[UDP]");
+    pthread_create(&u->thread, NULL, udp_worker, u);
+    pthread_detach(u->thread);
+    return addr;
+}
+
+/* udp_bench_run: janelas por `secs` segundos; devolve respostas/s e conta
+ * em lost as que não voltaram em 100 ms */
+static double udp_bench_run(int offload, double secs, long* lost, int* gso, int* gro) {
+    config.udp_offload = offload;
+    struct sockaddr_in addr = udp_bench_server();
+    int fd = udp_bench_socket();
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect udp");
+        exit(1);
+    }
+    /* o offload do cliente segue o mesmo teste do servidor */
+    struct udp_engine probe = { .fd = fd };
+    udp_offload_init(&probe);
+    *gso = probe.gso;
+    *gro = probe.gro;
+
+    static char req[UDP_GSO_SEGS * UDP_REQ_LEN];
+    memset(req, 'x', sizeof(req));
+    int segs = probe.gso ? UDP_GSO_SEGS : 1;
+    int nmsg = UDP_WINDOW / segs;
+    struct mmsghdr out[UDP_WINDOW];
+    struct iovec out_iov[UDP_WINDOW];
+    char out_ctl[UDP_WINDOW][UDP_CTL_SIZE];
+    memset(out, 0, sizeof(out));
+    for (int i = 0; i < nmsg; i++) {
+        out_iov[i] = (struct iovec){ req, (size_t)segs * UDP_REQ_LEN };
+        out[i].msg_hdr.msg_iov = &out_iov[i];
+        out[i].msg_hdr.msg_iovlen = 1;
+        if (segs > 1) {
+            struct msghdr* h = &out[i].msg_hdr;
+            h->msg_control = out_ctl[i];
+            h->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = UDP_REQ_LEN;
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        }
+    }
+
+    enum { IN = 64 };
+    static char bufs[IN][UDP_GRO_BUF];
+    struct mmsghdr in[IN];
+    struct iovec in_iov[IN];
+    char in_ctl[IN][UDP_CTL_SIZE];
+    memset(in, 0, sizeof(in));
+    for (int i = 0; i < IN; i++) {
+        in_iov[i] = (struct iovec){ bufs[i], sizeof(bufs[i]) };
+        in[i].msg_hdr.msg_iov = &in_iov[i];
+        in[i].msg_hdr.msg_iovlen = 1;
+        in[i].msg_hdr.msg_control = in_ctl[i];
+    }
+
+    long replies = 0;
+    *lost = 0;
+    double t0 = now_sec(), t;
+    while ((t = now_sec()) - t0 < secs) {
+        for (int off = 0; off < nmsg;) {
+            int r = sendmmsg(fd, out + off, nmsg - off, 0);
+            if (r < 0) {
+                perror("sendmmsg");
+                exit(1);
+            }
+            off += r;
+        }
+        int got = 0;
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        while (got < UDP_WINDOW && poll(&pfd, 1, 100) > 0) {
+            for (int i = 0; i < IN; i++) in[i].msg_hdr.msg_controllen = UDP_CTL_SIZE;
+            int n = recvmmsg(fd, in, IN, MSG_DONTWAIT, NULL);
+            for (int i = 0; i < n; i++) {
+                int seg = udp_gro_size(&in[i].msg_hdr);
+                got += seg > 0 ? (int)((in[i].msg_len + seg - 1) / seg) : 1;
+            }
+        }
+        replies += got;
+        if (got < UDP_WINDOW) *lost += UDP_WINDOW - got;
+    }
+    close(fd);
+    return replies / (t - t0);
+}
+
+static void bench_udp(void) {
+    int saved = config.log_level;
+    config.log_level = -1;   /* nem a linha de offload do udp_engine_init */
+    printf("== udp (loopback, janelas de %d requests de %d bytes; maior é melhor) ==\n",
+           UDP_WINDOW, UDP_REQ_LEN);
+    printf("%-14s %14s %10s %5s %5s\n", "offload", "pacotes/s", "perdidos", "GSO", "GRO");
+    for (int offload = 0; offload <= 1; offload++) {
+        long lost;
+        int gso, gro;
+        double pps = udp_bench_run(offload, 2.0, &lost, &gso, &gro);
+        printf("%-14s %14.0f %10ld %5s %5s\n", offload ? "udp_offload=1" : "udp_offload=0",
+               pps, lost, gso ? "sim" : "não", gro ? "sim" : "não");
+    }
+    printf("\n");
+    config.log_level = saved;
+}
+
+/* ---------- paths do root ---------- */
+
+/* path do request e o caminho relativo esperado (NULL = recusado) */
+static const char* path_cases[][2] = {
+    { "/",               "index.html" },
+    { "/index.html",     "index.html" },
+    { "/sub/a.css?v=2",  "sub/a.css" },
+    { "/sub/",           "sub/index.html" },
+    { "/a..b",           "a..b" },
+    { "//etc/passwd",    NULL },
+    { "/a//b",           NULL },
+    { "/sub//",          NULL },
+    { "/../etc/passwd",  NULL },
+    { "/sub/..",         NULL },
+    { "/sub/../../x",    NULL },
+    { "sem-barra",       NULL },
+};
+
+static void bench_paths(void) {
+    printf("== paths (file_rel_path) ==\n");
+    int wrong = 0;
+    for (size_t k = 0; k < sizeof(path_cases) / sizeof(path_cases[0]); k++) {
+        const char* path = path_cases[k][0];
+        const char* want = path_cases[k][1];
+        char rel[FILE_PATH_MAX];
+        struct http_slice s = { 0, (unsigned short)strlen(path) };
+        int ok = file_rel_path(path, s, rel);
+        int right = want ? ok && strcmp(rel, want) == 0 : !ok;
+        printf("%-18s %-16s %s\n", path, ok ? rel : "(recusado)", right ? "ok" : "resultado errado!");
+        wrong += !right;
+    }
+    printf("\n");
+    if (wrong) exit(1);
+}
+
+int main(int argc, char** argv) {
+    const char* which = argc > 1 ? argv[1] : NULL;
+    scan_init();
+    if (!which || strcmp(which, "parser") == 0) bench_parser();
+    if (!which || strcmp(which, "scan") == 0) bench_scan();
+    if (!which || strcmp(which, "poll") == 0) bench_poll();
+    if (!which || strcmp(which, "udp") == 0) bench_udp();
+    if (!which || strcmp(which, "paths") == 0) bench_paths();
+    return 0;
+}
@@ -1,7 +1,26 @@
+// client_http.c
+//
+// Uso: ./client_http [IP] [PORT]              um GET e imprime a resposta
+//      ./client_http <IP> <PORT> bench [...]  gerador de carga (ver bench_main)
+//      ./client_http <IP> <PORT> udp [...]    requests pelo protocolo UDP do modo 3
+//      ./client_http merge ARQ... [hist=ARQ]  junta histogramas de execuções
+//
+// Compile: gcc -Wall -O2 -pthread -o client_http client_http.c
+
+#define _GNU_SOURCE   // memmem, strcasestr
+
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -93,9 +112,775 @@ int Close(int connfd) {
 }
 
 
+// ---------------- modo benchmark ----------------
+//
+// ./client_http <IP> <PORT> bench [chave=valor ...]
+//   conns=N      conexões simultâneas (padrão 64)
+//   threads=M    threads, cada uma com seu epoll e N/M conexões (padrão: CPUs)
+//   duration=S   segundos de medição (padrão 10)
+//   requests=N   para depois de N requests (em vez de duration)
+//   keepalive=1  reaproveita a conexão (HTTP/1.1); 0 = uma conexão por request
+//   path=/x      caminho pedido (padrão /)
+//   rate=R       open-loop: R requests/s no total, em horários fixos
+//   hist=ARQ     grava o histograma de latências em ARQ (ver hist_dump)
+//
+// Sem rate (closed-loop) cada conexão manda um request, espera a resposta
+// inteira (pelos headers e Content-Length, ou até EOF) e manda o próximo; a
+// latência vai do envio (ou do connect, sem keep-alive) até o último byte.
+//
+// Com rate cada request tem um horário previsto de envio (início + k/rate)
+// e a latência é medida a partir desse horário, não do envio real: se o
+// servidor atrasa e todas as conexões estão ocupadas, os requests seguintes
+// esperam na fila e essa espera entra na medida. Medir do envio real esconde
+// justamente os piores casos (coordinated omission): o gerador para de
+// enviar enquanto o servidor está travado.
+
+// ---- histograma log-linear (estilo HDR) ----
+//
+// Valores em ns. Abaixo de 2^HIST_BITS cada valor tem seu balde; acima,
+// cada potência de 2 é dividida em 2^(HIST_BITS-1) baldes iguais, ou seja,
+// erro relativo < 1/128 em qualquer escala. Dois histogramas se juntam
+// somando os contadores, então threads e execuções diferentes se combinam
+// sem perder precisão.
+
+#define HIST_BITS    8
+#define HIST_SUB     (1 << (HIST_BITS - 1))
+#define HIST_MAX_LOG 44    // até 2^44 ns (~4.9 horas); acima disso satura
+#define HIST_BUCKETS ((1 << HIST_BITS) + (HIST_MAX_LOG - HIST_BITS) * HIST_SUB)
+
+struct hist {
+  unsigned long long count, min, max;
+  unsigned long long buckets[HIST_BUCKETS];
+};
+
+static int hist_index(unsigned long long v) {
+  if (v < (1ULL << HIST_BITS)) return (int)v;
+  int m = 63 - __builtin_clzll(v);
+  if (m >= HIST_MAX_LOG) return HIST_BUCKETS - 1;
+  int sub = (int)(v >> (m - (HIST_BITS - 1))) - HIST_SUB;
+  return (1 << HIST_BITS) + (m - HIST_BITS) * HIST_SUB + sub;
+}
+
+// hist_low/hist_high: menor e maior valor que caem no balde i
+static unsigned long long hist_low(int i) {
+  if (i < (1 << HIST_BITS)) return i;
+  int m = HIST_BITS + (i - (1 << HIST_BITS)) / HIST_SUB;
+  int sub = (i - (1 << HIST_BITS)) % HIST_SUB;
+  return (unsigned long long)(HIST_SUB + sub) << (m - (HIST_BITS - 1));
+}
+
+static unsigned long long hist_high(int i) {
+  if (i < (1 << HIST_BITS)) return i;
+  int m = HIST_BITS + (i - (1 << HIST_BITS)) / HIST_SUB;
+  return hist_low(i) + (1ULL << (m - (HIST_BITS - 1))) - 1;
+}
+
+static void hist_add(struct hist* h, unsigned long long v, unsigned long long n) {
+  if (n == 0) return;
+  if (h->count == 0 || v < h->min) h->min = v;
+  if (v > h->max) h->max = v;
+  h->count += n;
+  h->buckets[hist_index(v)] += n;
+}
+
+static void hist_merge(struct hist* into, const struct hist* h) {
+  if (h->count == 0) return;
+  if (into->count == 0 || h->min < into->min) into->min = h->min;
+  if (h->max > into->max) into->max = h->max;
+  into->count += h->count;
+  for (int i = 0; i < HIST_BUCKETS; i++) into->buckets[i] += h->buckets[i];
+}
+
+// hist_percentile: maior valor equivalente ao balde do percentil p
+static unsigned long long hist_percentile(const struct hist* h, double p) {
+  if (h->count == 0) return 0;
+  unsigned long long rank = (unsigned long long)(p * h->count + 0.5), seen = 0;
+  if (rank < 1) rank = 1;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) return hist_high(i) < h->max ? hist_high(i) : h->max;
+  }
+  return h->max;
+}
+
+static void hist_print(const struct hist* h) {
+  if (h->count == 0) return;
+  printf("latência us: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+         h->min / 1e3, hist_percentile(h, 0.50) / 1e3, hist_percentile(h, 0.90) / 1e3,
+         hist_percentile(h, 0.99) / 1e3, hist_percentile(h, 0.999) / 1e3, h->max / 1e3);
+}
+
+// hist_dump: formato texto, uma linha "valor contagem" por balde não vazio
+// (valor = menor valor do balde, em ns). Lido de volta por hist_load.
+static int hist_dump(const struct hist* h, const char* path) {
+  FILE* f = fopen(path, "w");
+  if (f == NULL) return -1;
+  fprintf(f, "# client_http hist v1 ns\n");
+  fprintf(f, "min %llu\nmax %llu\n", h->min, h->max);
+  for (int i = 0; i < HIST_BUCKETS; i++)
+    if (h->buckets[i]) fprintf(f, "%llu %llu\n", hist_low(i), h->buckets[i]);
+  return fclose(f);
+}
+
+static int hist_load(struct hist* h, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) return -1;
+  struct hist one;
+  memset(&one, 0, sizeof(one));
+  unsigned long long min = 0, max = 0, v, n;
+  char line[128];
+  int ok = fgets(line, sizeof(line), f) && strncmp(line, "# client_http hist v1", 21) == 0;
+  while (ok && fgets(line, sizeof(line), f)) {
+    if (sscanf(line, "min %llu", &min) == 1 || sscanf(line, "max %llu", &max) == 1) continue;
+    if (sscanf(line, "%llu %llu", &v, &n) != 2) ok = 0;
+    else hist_add(&one, v, n);
+  }
+  fclose(f);
+  if (!ok) {
+    errno = EINVAL;
+    return -1;
+  }
+  // os baldes guardam só o menor valor; min/max exatos vêm do cabeçalho
+  if (one.count) {
+    one.min = min;
+    one.max = max;
+  }
+  hist_merge(h, &one);
+  return 0;
+}
+
+// ---- conexões ----
+
+enum { BC_IDLE, BC_CONNECTING, BC_READING, BC_READY };
+
+struct bench_conn {
+  int fd;
+  int state;            // BC_IDLE: sem socket; BC_READY: aberta, esperando o horário
+  size_t got;           // bytes da resposta corrente
+  size_t need;          // tamanho total da resposta (0 = até EOF)
+  size_t hdr_len;       // 0 = headers ainda incompletos
+  int server_keeps;     // resposta manteve a conexão aberta
+  int reused;           // request corrente foi enviado numa conexão reaproveitada
+  long long start_ns;   // início do request corrente (previsto, com rate)
+  char hdr[MAXLINE];    // headers da resposta (o corpo é só contado)
+};
+
+struct bench_thread {
+  pthread_t tid;
+  int nconns;
+  struct bench_conn* conns;
+  struct bench_conn** free;   // rate: conexões sem request em andamento
+  int nfree;
+  int inflight;               // requests em andamento
+  int stopped;                // rate: não inicia mais requests
+  long long next_ns;          // rate: horário previsto do próximo request
+  long long interval_ns;      // rate: intervalo entre requests desta thread
+  long long requests, errors, bytes, late;
+  struct hist hist;
+};
+
+static struct {
+  struct sockaddr_in addr;
+  int conns, threads, keepalive;
+  double duration, rate;
+  long long requests;   // 0 = limitado por duration
+  const char* path;
+  const char* hist_path;
+  char req[512];
+  size_t req_len;
+  long long end_ns;
+} bench = { .conns = 64, .threads = 0, .keepalive = 1, .duration = 10, .requests = 0, .path = "/" };
+
+static long long bench_tickets;   // requests que ainda podem ser iniciados
+
+static long long now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// bench_take: pode iniciar mais um request?
+static int bench_take(void) {
+  if (now_ns() >= bench.end_ns) return 0;
+  if (bench.requests == 0) return 1;
+  return __atomic_sub_fetch(&bench_tickets, 1, __ATOMIC_RELAXED) >= 0;
+}
+
+// bench_send: envia o request inteiro (cabe no buffer do socket)
+static int bench_send(struct bench_conn* c) {
+  ssize_t n = send(c->fd, bench.req, bench.req_len, MSG_NOSIGNAL);
+  if (n != (ssize_t)bench.req_len) return -1;
+  c->got = c->need = c->hdr_len = 0;
+  c->server_keeps = 0;
+  c->state = BC_READING;
+  return 0;
+}
+
+// bench_open: conexão nova non-blocking; o request sai quando o connect completar
+static int bench_open(int epfd, struct bench_conn* c, long long start) {
+  c->start_ns = start;
+  c->reused = 0;
+  c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  if (c->fd < 0) return -1;
+  int one = 1;
+  setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (connect(c->fd, (struct sockaddr*)&bench.addr, sizeof(bench.addr)) < 0 && errno != EINPROGRESS) {
+    close(c->fd);
+    c->fd = -1;
+    return -1;
+  }
+  c->state = BC_CONNECTING;
+  struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = c };
+  return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+static void bench_close(struct bench_conn* c) {
+  if (c->fd >= 0) close(c->fd);   // close tira o fd do epoll
+  c->fd = -1;
+  c->state = BC_IDLE;
+}
+
+// bench_release: conexão sem request; com rate volta para a lista livre
+static void bench_release(struct bench_thread* t, struct bench_conn* c) {
+  if (bench.rate > 0) t->free[t->nfree++] = c;
+}
+
+// bench_issue: inicia um request em c (aberta ou não) com início em start
+static void bench_issue(int epfd, struct bench_thread* t, struct bench_conn* c, long long start) {
+  if (c->state == BC_READY) {
+    c->start_ns = start;
+    c->reused = 1;
+    if (bench_send(c) == 0) {
+      t->inflight++;
+      return;
+    }
+  } else if (bench_open(epfd, c, start) == 0) {
+    t->inflight++;
+    return;
+  }
+  t->errors++;
+  bench_close(c);
+  bench_release(t, c);
+}
+
+// bench_headers: headers completos em c->hdr? calcula need e server_keeps
+static void bench_headers(struct bench_conn* c) {
+  size_t avail = c->got < sizeof(c->hdr) ? c->got : sizeof(c->hdr);
+  char* end = memmem(c->hdr, avail, "\r\n\r\n", 4);
+  if (end == NULL) return;
+  c->hdr_len = end + 4 - c->hdr;
+  *end = '\0';
+  char* cl = strcasestr(c->hdr, "\r\nContent-Length:");
+  c->need = cl ? c->hdr_len + strtoul(cl + 17, NULL, 10) : 0;
+  c->server_keeps = bench.keepalive && c->need > 0 && strcasestr(c->hdr, "\r\nConnection: close") == NULL;
+}
+
+// bench_next: terminou um request; closed-loop já inicia o próximo
+static void bench_next(int epfd, struct bench_thread* t, struct bench_conn* c, int ok) {
+  t->inflight--;
+  if (ok) {
+    t->requests++;
+    hist_add(&t->hist, now_ns() - c->start_ns, 1);
+  } else {
+    t->errors++;
+  }
+  if (ok && c->server_keeps) c->state = BC_READY;
+  else bench_close(c);
+
+  if (bench.rate > 0) {
+    bench_release(t, c);
+    return;
+  }
+  if (!bench_take()) {
+    bench_close(c);
+    return;
+  }
+  bench_issue(epfd, t, c, now_ns());
+}
+
+static void bench_on_event(int epfd, struct bench_thread* t, struct bench_conn* c, unsigned events) {
+  if (c->state == BC_CONNECTING) {
+    // EPOLLERR/EPOLLHUP: connect recusado ou resetado, erro já aqui sem
+    // tentar o send; o getsockopt lê (e limpa) o erro pendente de qualquer forma
+    int err = 0;
+    socklen_t len = sizeof(err);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+    if ((events & (EPOLLERR | EPOLLHUP)) || err != 0 || bench_send(c) < 0
+        || epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev) < 0)
+      bench_next(epfd, t, c, 0);
+    return;
+  }
+  if (c->state != BC_READING) {
+    // BC_READY: o servidor fechou (ou mandou lixo) entre requests
+    if (c->state == BC_READY) {
+      bench_close(c);
+      // continua na lista livre; o próximo request reabre
+    }
+    return;
+  }
+
+  for (;;) {
+    char scratch[16384];
+    char* dst = scratch;
+    size_t room = sizeof(scratch);
+    if (c->hdr_len == 0 && c->got < sizeof(c->hdr)) {
+      dst = c->hdr + c->got;
+      room = sizeof(c->hdr) - c->got;
+    }
+    ssize_t n = read(c->fd, dst, room);
+    if (n > 0) {
+      c->got += n;
+      t->bytes += n;
+      if (c->hdr_len == 0) bench_headers(c);
+      if (c->need > 0 && c->got >= c->need) {
+        bench_next(epfd, t, c, 1);
+        return;
+      }
+      if (c->hdr_len == 0 && c->got >= sizeof(c->hdr)) {
+        bench_next(epfd, t, c, 0);   // headers não cabem: resposta inválida
+        return;
+      }
+    } else if (n == 0) {
+      // o servidor pode fechar uma conexão keep-alive antes do próximo
+      // request (keepalive_max, timeout): reabre e repete sem contar erro
+      if (c->got == 0 && c->reused) {
+        bench_close(c);
+        if (bench_open(epfd, c, c->start_ns) < 0) bench_next(epfd, t, c, 0);
+        return;
+      }
+      // resposta sem Content-Length termina no EOF
+      bench_next(epfd, t, c, c->hdr_len > 0 && c->need == 0);
+      return;
+    } else {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) bench_next(epfd, t, c, 0);
+      return;
+    }
+  }
+}
+
+// bench_schedule: rate; inicia os requests cujo horário já passou, enquanto
+// houver conexão livre. Devolve quanto esperar (ns) até o próximo horário.
+static long long bench_schedule(int epfd, struct bench_thread* t) {
+  long long now = now_ns();
+  while (!t->stopped && t->next_ns <= now && t->nfree > 0) {
+    if (!bench_take()) {
+      t->stopped = 1;
+      break;
+    }
+    // atrasado: o horário previsto já tinha passado há mais de um intervalo
+    if (now - t->next_ns > t->interval_ns) t->late++;
+    bench_issue(epfd, t, t->free[--t->nfree], t->next_ns);
+    t->next_ns += t->interval_ns;
+  }
+  long long wait = t->next_ns - now;
+  if (t->stopped || t->nfree == 0 || wait > 100000000LL) return 100000000LL;
+  return wait;
+}
+
+// bench_wait: epoll_wait com timeout em ns. epoll_wait só tem resolução de
+// ms, o que com rate alto perderia o horário de quase todo request;
+// epoll_pwait2 (Linux 5.11) aceita timespec. Sem ele, arredonda para cima.
+static int bench_wait(int epfd, struct epoll_event* events, int max, long long timeout_ns) {
+  static int no_pwait2;
+  if (!no_pwait2) {
+    struct timespec ts = { timeout_ns / 1000000000LL, timeout_ns % 1000000000LL };
+    int n = epoll_pwait2(epfd, events, max, &ts, NULL);
+    if (n >= 0 || errno != ENOSYS) return n;
+    no_pwait2 = 1;
+  }
+  return epoll_wait(epfd, events, max, (int)((timeout_ns + 999999) / 1000000));
+}
+
+static void* bench_worker(void* arg) {
+  struct bench_thread* t = arg;
+  int epfd = epoll_create1(0);
+  if (epfd < 0) {
+    perror("epoll_create1");
+    return NULL;
+  }
+  for (int i = t->nconns - 1; i >= 0; i--) {
+    struct bench_conn* c = &t->conns[i];
+    c->fd = -1;
+    c->state = BC_IDLE;
+    if (bench.rate > 0) bench_release(t, c);
+    else if (bench_take()) bench_issue(epfd, t, c, now_ns());
+  }
+
+  struct epoll_event events[256];
+  for (;;) {
+    long long timeout = 100000000LL;
+    if (bench.rate > 0) timeout = bench_schedule(epfd, t);
+    if (t->inflight == 0 && (bench.rate == 0 || t->stopped)) break;
+    if (now_ns() >= bench.end_ns) break;
+
+    int n = bench_wait(epfd, events, 256, timeout);
+    for (int i = 0; i < n; i++) bench_on_event(epfd, t, events[i].data.ptr, events[i].events);
+  }
+  // requests em andamento no fim do prazo não entram na conta
+  for (int i = 0; i < t->nconns; i++) bench_close(&t->conns[i]);
+  close(epfd);
+  return NULL;
+}
+
+// bench_main: roda o benchmark contra ip:port com as opções em argv
+static int bench_main(const char* ip, unsigned short port, int argc, char** argv) {
+  for (int i = 0; i < argc; i++) {
+    char* eq = strchr(argv[i], '=');
+    if (eq == NULL) {
+      fprintf(stderr, "opção inválida '%s' (esperado chave=valor)\n", argv[i]);
+      return 1;
+    }
+    *eq = '\0';
+    const char* v = eq + 1;
+    if (strcmp(argv[i], "conns") == 0) bench.conns = atoi(v);
+    else if (strcmp(argv[i], "threads") == 0) bench.threads = atoi(v);
+    else if (strcmp(argv[i], "duration") == 0) bench.duration = atof(v);
+    else if (strcmp(argv[i], "requests") == 0) bench.requests = atoll(v);
+    else if (strcmp(argv[i], "keepalive") == 0) bench.keepalive = atoi(v);
+    else if (strcmp(argv[i], "path") == 0) bench.path = v;
+    else if (strcmp(argv[i], "rate") == 0) bench.rate = atof(v);
+    else if (strcmp(argv[i], "hist") == 0) bench.hist_path = v;
+    else {
+      fprintf(stderr, "opção desconhecida '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+  if (bench.conns < 1) bench.conns = 1;
+  if (bench.threads <= 0) bench.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (bench.threads > bench.conns) bench.threads = bench.conns;
+
+  memset(&bench.addr, 0, sizeof(bench.addr));
+  bench.addr.sin_family = AF_INET;
+  bench.addr.sin_port = htons(port);
+  if (inet_pton(AF_INET, ip, &bench.addr.sin_addr) <= 0) {
+    fprintf(stderr, "IP inválido: %s\n", ip);
+    return 1;
+  }
+  bench.req_len = snprintf(bench.req, sizeof(bench.req), "GET %s HTTP/1.%d\r\nHost: teste\r\n%s\r\n",
+                           bench.path, bench.keepalive ? 1 : 0,
+                           bench.keepalive ? "" : "Connection: close\r\n");
+
+  // cada conexão é um fd: sobe o limite até o máximo permitido
+  struct rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)bench.conns + 64) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+
+  struct bench_thread* ts = calloc(bench.threads, sizeof(*ts));
+  struct bench_conn* conns = calloc(bench.conns, sizeof(*conns));
+  struct bench_conn** free_list = calloc(bench.conns, sizeof(*free_list));
+  if (ts == NULL || conns == NULL || free_list == NULL) {
+    perror("calloc");
+    return 1;
+  }
+
+  bench_tickets = bench.requests;
+  long long start = now_ns();
+  bench.end_ns = bench.requests ? start + 3600LL * 1000000000LL
+                                : start + (long long)(bench.duration * 1e9);
+  for (int i = 0, first = 0; i < bench.threads; i++) {
+    struct bench_thread* t = &ts[i];
+    t->nconns = bench.conns / bench.threads + (i < bench.conns % bench.threads);
+    t->conns = conns + first;
+    t->free = free_list + first;
+    first += t->nconns;
+    if (bench.rate > 0) {
+      // cada thread gera rate/threads; horários intercalados entre threads
+      t->interval_ns = (long long)(1e9 * bench.threads / bench.rate);
+      if (t->interval_ns < 1) t->interval_ns = 1;
+      t->next_ns = start + t->interval_ns * i / bench.threads;
+    }
+    pthread_create(&t->tid, NULL, bench_worker, t);
+  }
+
+  long long requests = 0, errors = 0, bytes = 0, late = 0;
+  struct hist* all = calloc(1, sizeof(*all));
+  for (int i = 0; i < bench.threads; i++) {
+    pthread_join(ts[i].tid, NULL);
+    requests += ts[i].requests;
+    errors += ts[i].errors;
+    bytes += ts[i].bytes;
+    late += ts[i].late;
+    if (all) hist_merge(all, &ts[i].hist);
+  }
+  double secs = (now_ns() - start) / 1e9;
+
+  printf("[bench] %s:%u %s conns=%d threads=%d keepalive=%d", ip, port, bench.path,
+         bench.conns, bench.threads, bench.keepalive);
+  if (bench.rate > 0) printf(" rate=%.0f", bench.rate);
+  printf("\n");
+  printf("requests   : %lld em %.2fs (erros: %lld)\n", requests, secs, errors);
+  printf("req/s      : %.1f\n", requests / secs);
+  if (bench.rate > 0) printf("atrasados  : %lld (enviados depois do horário previsto)\n", late);
+  printf("throughput : %.2f MB/s recebidos\n", bytes / secs / 1e6);
+  if (all) {
+    hist_print(all);
+    if (bench.hist_path && hist_dump(all, bench.hist_path) < 0) perror(bench.hist_path);
+  }
+  free(all);
+  free(ts);
+  free(conns);
+  free(free_list);
+  return errors > 0 && requests == 0;
+}
+
+// ---------------- modo UDP ----------------
+//
+// ./client_http <IP> <PORT> udp [chave=valor ...]
+//   inflight=N   requests em andamento no mesmo socket (padrão 64)
+//   requests=N   total de requests (padrão 10000; com 1 imprime a resposta)
+//   path=/x      rota pedida (padrão /; /echo devolve o payload)
+//   payload=T    payload do request
+//   timeout=MS   sem resposta completa em MS ms o request conta como
+//                perdido e o slot é reaproveitado (padrão 1000)
+//
+// Fala o protocolo do modo 3 do server_http.c (struct udp_frame, copiada
+// abaixo). Cada request tem um id crescente e ocupa o slot id % inflight;
+// uma resposta cujo id não bate com o do slot (atrasada, de um request já
+// dado como perdido) é descartada. Os pedaços de uma resposta são
+// copiados na posição frag * UDP_FRAG_DATA e a resposta termina quando
+// todos chegaram. Os requests novos de uma volta saem num sendmmsg e as
+// respostas são lidas em lotes com recvmmsg.
+
+#define UDP_FRAG_SIZE 1200
+#define UDP_FRAG_MAX  54
+#define UDP_MAGIC     0x4d43
+#define UDP_VERSION   1
+#define UDP_BATCH     64
+
+struct udp_frame {          // igual ao do server_http.c, em ordem de rede
+  uint16_t magic;
+  uint8_t version;
+  uint8_t type;             // 1 = request, 2 = resposta
+  uint32_t id;
+  uint16_t status;
+  uint16_t route_len;
+  uint16_t frag;
+  uint16_t nfrags;
+};
+
+#define UDP_FRAG_DATA (UDP_FRAG_SIZE - sizeof(struct udp_frame))
+
+struct udp_slot {
+  uint32_t id;
+  int active;
+  long long start_ns;
+  int status;
+  int nfrags;               // 0 = nenhum pedaço ainda
+  int got;
+  unsigned long long seen;  // bit por pedaço recebido
+  size_t len;
+  char* body;               // UDP_FRAG_MAX * UDP_FRAG_DATA, alocado no primeiro uso
+};
+
+static struct {
+  int inflight;
+  long long requests;
+  const char* path;
+  const char* payload;
+  long long timeout_ns;
+} udpc = { .inflight = 64, .requests = 10000, .path = "/", .payload = "", .timeout_ns = 1000000000LL };
+
+// udp_slot_done: resposta completa (ou perdida, com ok = 0)
+static void udp_slot_done(struct udp_slot* s, int ok, struct hist* h, long long* done, long long* lost) {
+  s->active = 0;
+  if (!ok) {
+    (*lost)++;
+    return;
+  }
+  (*done)++;
+  hist_add(h, now_ns() - s->start_ns, 1);
+  if (udpc.requests == 1) {
+    printf("#%u status %d, %zu bytes em %d pedaço(s)\n", s->id, s->status, s->len, s->nfrags);
+    fwrite(s->body ? s->body : "", 1, s->len, stdout);
+    printf("\n");
+  }
+}
+
+// udp_on_reply: um datagrama de resposta
+static void udp_on_reply(struct udp_slot* slots, const char* buf, size_t len, struct hist* h,
+                         long long* done, long long* lost, long long* bytes) {
+  struct udp_frame f;
+  if (len < sizeof(f)) return;
+  memcpy(&f, buf, sizeof(f));
+  if (ntohs(f.magic) != UDP_MAGIC || f.type != 2) return;
+  uint32_t id = ntohl(f.id);
+  int frag = ntohs(f.frag), nfrags = ntohs(f.nfrags);
+  struct udp_slot* s = &slots[id % udpc.inflight];
+  if (!s->active || s->id != id || nfrags < 1 || nfrags > UDP_FRAG_MAX || frag >= nfrags) return;
+  if (s->nfrags && s->nfrags != nfrags) return;
+  if (s->seen & (1ULL << frag)) return;   // duplicado
+  size_t n = len - sizeof(f);
+  if (n > UDP_FRAG_DATA || (frag < nfrags - 1 && n != UDP_FRAG_DATA)) return;
+
+  if (s->body == NULL && (s->body = malloc(UDP_FRAG_MAX * UDP_FRAG_DATA)) == NULL) return;
+  memcpy(s->body + frag * UDP_FRAG_DATA, buf + sizeof(f), n);
+  if (frag == nfrags - 1) s->len = frag * UDP_FRAG_DATA + n;
+  s->nfrags = nfrags;
+  s->status = ntohs(f.status);
+  s->seen |= 1ULL << frag;
+  *bytes += n;
+  if (++s->got == nfrags) udp_slot_done(s, 1, h, done, lost);
+}
+
+static int udp_main(const char* ip, unsigned short port, int argc, char** argv) {
+  for (int i = 0; i < argc; i++) {
+    char* eq = strchr(argv[i], '=');
+    if (eq == NULL) {
+      fprintf(stderr, "opção inválida '%s' (esperado chave=valor)\n", argv[i]);
+      return 1;
+    }
+    *eq = '\0';
+    const char* v = eq + 1;
+    if (strcmp(argv[i], "inflight") == 0) udpc.inflight = atoi(v);
+    else if (strcmp(argv[i], "requests") == 0) udpc.requests = atoll(v);
+    else if (strcmp(argv[i], "path") == 0) udpc.path = v;
+    else if (strcmp(argv[i], "payload") == 0) udpc.payload = v;
+    else if (strcmp(argv[i], "timeout") == 0) udpc.timeout_ns = atoll(v) * 1000000LL;
+    else {
+      fprintf(stderr, "opção desconhecida '%s'\n", argv[i]);
+      return 1;
+    }
+  }
+  if (udpc.inflight < 1) udpc.inflight = 1;
+  if (udpc.requests < 1) udpc.requests = 1;
+  if (udpc.inflight > udpc.requests) udpc.inflight = (int)udpc.requests;
+
+  // request: cabeçalho + rota + payload, o mesmo para todos a menos do id
+  char req[UDP_FRAG_SIZE];
+  size_t rlen = strlen(udpc.path), plen = strlen(udpc.payload);
+  if (sizeof(struct udp_frame) + rlen + plen > sizeof(req)) {
+    fprintf(stderr, "rota + payload maiores que um datagrama (%zu bytes)\n", UDP_FRAG_DATA);
+    return 1;
+  }
+  struct udp_frame f = { .magic = htons(UDP_MAGIC), .version = UDP_VERSION, .type = 1,
+                         .route_len = htons(rlen) };
+  memcpy(req, &f, sizeof(f));
+  memcpy(req + sizeof(f), udpc.path, rlen);
+  memcpy(req + sizeof(f) + rlen, udpc.payload, plen);
+  size_t req_len = sizeof(f) + rlen + plen;
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+  if (fd < 0 || inet_pton(AF_INET, ip, &addr.sin_addr) <= 0
+      || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("socket/connect udp");
+    return 1;
+  }
+  int size = 4 << 20;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+  struct udp_slot* slots = calloc(udpc.inflight, sizeof(*slots));
+  char (*reqs)[UDP_FRAG_SIZE] = malloc((size_t)udpc.inflight * UDP_FRAG_SIZE);
+  struct mmsghdr* out = calloc(udpc.inflight, sizeof(*out));
+  struct iovec* out_iov = calloc(udpc.inflight, sizeof(*out_iov));
+  static char bufs[UDP_BATCH][UDP_FRAG_SIZE];
+  struct mmsghdr in[UDP_BATCH];
+  struct iovec in_iov[UDP_BATCH];
+  struct hist* h = calloc(1, sizeof(*h));
+  if (slots == NULL || reqs == NULL || out == NULL || out_iov == NULL || h == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  memset(in, 0, sizeof(in));
+  for (int i = 0; i < UDP_BATCH; i++) {
+    in_iov[i] = (struct iovec){ bufs[i], sizeof(bufs[i]) };
+    in[i].msg_hdr.msg_iov = &in_iov[i];
+    in[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  uint32_t next_id = 1;
+  long long sent = 0, done = 0, lost = 0, bytes = 0;
+  long long start = now_ns();
+  while (done + lost < udpc.requests) {
+    // slots livres recebem requests novos, todos num sendmmsg
+    int nout = 0;
+    long long now = now_ns();
+    for (int i = 0; i < udpc.inflight; i++) {
+      struct udp_slot* s = &slots[i];
+      if (s->active && now - s->start_ns >= udpc.timeout_ns) udp_slot_done(s, 0, h, &done, &lost);
+      if (s->active || sent == udpc.requests) continue;
+      // o id escolhe o slot: pula até o próximo que cai em i
+      next_id += (i - next_id % udpc.inflight + udpc.inflight) % udpc.inflight;
+      s->id = next_id++;
+      s->active = 1;
+      s->start_ns = now;
+      s->nfrags = s->got = 0;
+      s->seen = 0;
+      s->len = 0;
+      memcpy(reqs[i], req, req_len);
+      uint32_t nid = htonl(s->id);
+      memcpy(reqs[i] + offsetof(struct udp_frame, id), &nid, sizeof(nid));
+      out_iov[nout] = (struct iovec){ reqs[i], req_len };
+      out[nout].msg_hdr.msg_iov = &out_iov[nout];
+      out[nout].msg_hdr.msg_iovlen = 1;
+      nout++;
+      sent++;
+    }
+    for (int off = 0; off < nout;) {
+      int r = sendmmsg(fd, out + off, nout - off, 0);
+      if (r < 0) {
+        if (errno == EINTR) continue;
+        perror("sendmmsg");
+        return 1;
+      }
+      off += r;
+    }
+
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, 10) <= 0) continue;
+    int n = recvmmsg(fd, in, UDP_BATCH, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < n; i++) udp_on_reply(slots, bufs[i], in[i].msg_len, h, &done, &lost, &bytes);
+  }
+  double secs = (now_ns() - start) / 1e9;
+
+  printf("[udp] %s:%u %s inflight=%d\n", ip, port, udpc.path, udpc.inflight);
+  printf("requests   : %lld em %.2fs (perdidos: %lld)\n", done, secs, lost);
+  printf("req/s      : %.1f\n", done / secs);
+  printf("throughput : %.2f MB/s recebidos\n", bytes / secs / 1e6);
+  hist_print(h);
+  for (int i = 0; i < udpc.inflight; i++) free(slots[i].body);
+  free(slots);
+  free(reqs);
+  free(out);
+  free(out_iov);
+  free(h);
+  close(fd);
+  return lost > 0 && done == 0;
+}
+
+// merge_main: ./client_http merge ARQ... junta histogramas gravados com hist=
+static int merge_main(int argc, char** argv) {
+  struct hist* all = calloc(1, sizeof(*all));
+  if (all == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  const char* out = NULL;
+  for (int i = 0; i < argc; i++) {
+    if (strncmp(argv[i], "hist=", 5) == 0) out = argv[i] + 5;
+    else if (hist_load(all, argv[i]) < 0) {
+      fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+      free(all);
+      return 1;
+    }
+  }
+  printf("[merge] %d arquivo(s), %llu requests\n", argc - (out != NULL), all->count);
+  hist_print(all);
+  if (out && hist_dump(all, out) < 0) perror(out);
+  free(all);
+  return 0;
+}
+
 int main(int argc, char **argv) {
     int    sockfd;
 
+    if (argc >= 2 && strcmp(argv[1], "merge") == 0)
+        return merge_main(argc - 2, argv + 2);
+
     // IP/PORT (argumentos ou server.info)
     char ip[INET_ADDRSTRLEN + 1] = "143.106.16.22";
     unsigned short port = 0;
@@ -121,6 +906,11 @@ int main(int argc, char **argv) {
 
     }
 
+    if (argc >= 4 && strcmp(argv[3], "bench") == 0)
+        return bench_main(ip, port, argc - 4, argv + 4);
+    if (argc >= 4 && strcmp(argv[3], "udp") == 0)
+        return udp_main(ip, port, argc - 4, argv + 4);
+
     sockfd = Socket();
     
     Connect(sockfd, ip, port);
@@ -1,34 +1,615 @@
 /* server_http.c
  *
  * Versão estendida para o Exercício 5:
- *  - Mode 0: servidor concorrente baseado em fork() (original)
+ *  - Mode 0: servidor concorrente com pool de processos pré-forkados
+ *            (prefork=0: um fork() por conexão, como no original)
  *  - Mode 1: servidor single-process usando select()
  *  - Mode 2: servidor single-process usando poll()
  *  - Mode 3: servidor single-process usando select() para TCP + UDP
+ *            (UDP com protocolo próprio de request/resposta, ver struct
+ *            udp_frame)
+ *  - Mode 4: servidor single-process usando epoll() edge-triggered
+ *  - Mode 5: um reactor epoll por thread, cada um com listening socket
+ *            próprio (SO_REUSEPORT)
+ *  - Mode 6: servidor single-process usando io_uring (accept multishot,
+ *            recv com ring de buffers, envio + close ligados); sem
+ *            suporte no kernel, roda como o modo 4
  *
- * Compile: gcc -Wall -O2 -o server_http server_http.c
+ * Uso: ./server_http [porta] [backlog] [sleep_time] [mode] [chave=valor ...]
+ *  opções:
+ *    workers=N   número de reactors do modo 5 (padrão: CPUs online)
+ *    pin_cpu=1   fixa cada reactor do modo 5 em uma CPU
+ *    prefork=N   filhos iniciais do modo 0 (padrão 4, 0 = fork por conexão)
+ *    min_spare=N / max_spare=N / max_children=N
+ *                limites de filhos ociosos e total do pool do modo 0
+ *    keepalive_timeout=S  fecha conexões keep-alive ociosas após S segundos
+ *                (padrão 5)
+ *    header_timeout=S     prazo para um request chegar inteiro, contado da
+ *                conexão (ou do primeiro byte) (padrão 10; 0 = sem prazo)
+ *    write_timeout=S      fecha a conexão se o envio ficar parado S segundos
+ *                (padrão 10; 0 = sem prazo)
+ *    keepalive_max=N      requests por conexão antes de fechar (padrão 100)
+ *    max_conns=N conexões abertas ao mesmo tempo nos modos 1 a 6 (padrão:
+ *                RLIMIT_NOFILE, já elevado ao teto, menos uma reserva);
+ *                com a tabela cheia o accept pausa e os clientes esperam
+ *                na fila do listen. No modo 5 o limite é dividido entre
+ *                os reactors
+ *    simd=0      desliga a varredura SSE4.2/AVX2 do parser
+ *    date=0      respostas sem o header Date:
+ *    root=DIR    serve GET /caminho a partir de DIR (sendfile)
+ *    file_cache=N  fds de arquivos mantidos abertos por thread (padrão 64)
+ *    store_max=N arquivos do root de até N bytes são servidos da RAM;
+ *                SIGHUP recarrega o root sem derrubar conexões
+ *    log_level=N 0 = só eventos do servidor, 1 = + conexões (padrão),
+ *                2 = + cada request recebido
+ *    log_sample=N  registra, em média, 1 de cada N mensagens de conexão/request
+ *    metrics=0   desliga os contadores e a rota GET /metrics (Prometheus)
+ *    udp_batch=N datagramas lidos por recvmmsg e respondidos por sendmmsg
+ *                no modo 3 (padrão 64, até 1024)
+ *    udp_workers=N  modo 3: N threads com socket UDP próprio (SO_REUSEPORT)
+ *                em vez do UDP no laço do select (padrão 0)
+ *    udp_offload=0  desliga UDP_SEGMENT (GSO) e UDP_GRO no modo 3
+ *    tls=1       HTTPS nos modos 1 a 5 (o 6 roda como o 4); precisa do
+ *                build com OpenSSL
+ *    tls_cert=ARQ / tls_key=ARQ  certificado (cadeia) e chave PEM; sem
+ *                eles é gerado um autoassinado para localhost na partida
+ *    tls_tickets=N  session tickets por handshake TLS 1.3 (padrão 2;
+ *                0 = sem retomada por ticket)
+ *    ktls=0      não entrega a criptografia ao kernel (kTLS) depois do
+ *                handshake
+ *    upstream=HOST:PORTA  proxy reverso: requests cujo path começa por
+ *                proxy= vão para este servidor HTTP (modos 4 a 6; o 6
+ *                roda como o 4)
+ *    proxy=PREFIXO  paths repassados ao upstream (padrão "/"; /metrics
+ *                continua local); casa por segmento: /api não pega /apix
+ *    proxy_pool=N  conexões keep-alive ociosas com o upstream guardadas
+ *                por thread (padrão 32)
+ *    proxy_splice=0  copia o corpo das respostas do upstream em espaço de
+ *                usuário em vez de usar splice()
+ *
+ * Compile: gcc -Wall -O2 -pthread -o server_http server_http.c
+ *   com TLS: gcc -Wall -O2 -pthread -DHAVE_OPENSSL -o server_http server_http.c -lssl -lcrypto
  *
  */
 
+#define _GNU_SOURCE   /* accept4, SOCK_NONBLOCK */
+
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/io_uring.h>
+#include <linux/openat2.h>
+#include <dirent.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <limits.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#ifdef HAVE_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <openssl/x509.h>
+#endif
 
 /* constantes */
 #define LISTENQ      0
 #define MAXLINE 4096
 #define MAXDATASIZE  256
+#define MAX_EVENTS    256   /* eventos devolvidos por chamada de epoll_wait */
+#define MAX_PIPELINE   16   /* respostas enfileiradas por writev */
+#define HTTP_MAX_HEADERS 32         /* headers por request */
+#define HTTP_MAX_HEADER_BYTES MAXLINE  /* request inteiro precisa caber no buffer */
+#define DATE_LEN        29   /* "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define FILE_PATH_MAX  256   /* path relativo ao root */
+#define FILE_CACHE_BUCKETS 256
+#define FILE_HDR_MAX   256   /* headers da resposta de um arquivo */
+#define UR_SQ_ENTRIES  256   /* SQEs do io_uring (modo 6) */
+#define UR_CQ_ENTRIES 4096
+#define UR_NBUFS       256   /* buffers de recepção registrados (potência de 2) */
+#define UR_BUF_SIZE MAXLINE
+#define UR_ACCEPT_SLACK 64   /* folga em max_conns abaixo da qual o accept é um por vez */
+#define UDP_BATCH_MAX 1024   /* teto de udp_batch */
+#define UDP_PENDING_MAX 4096 /* respostas UDP esperando o sleep_time */
+#define UDP_GSO_SEGS 64      /* segmentos por envio GSO (UDP_MAX_SEGMENTS do kernel) */
+#define UDP_GRO_BUF 65536    /* buffer de um datagrama agregado pelo GRO */
+#define UDP_GSO_BYTES 65000  /* teto de uma mensagem GSO (cabe num datagrama IP) */
+#define UDP_FRAG_SIZE 1200   /* maior datagrama do protocolo (cabe em MTU 1280) */
+#define UDP_FRAG_MAX 54      /* pedaços por resposta: 54 * 1200 cabe num envio GSO */
+#define TLS_CHUNK 16384      /* bytes por SSL_write sem kTLS (um registro) */
+#define UDP_MAGIC 0x4d43     /* "MC" */
+#define UDP_VERSION 1
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#define LOG_RING      1024   /* células do ring do log (potência de 2) */
+#define LOG_MSG_MAX   1000   /* argumentos por célula e texto por mensagem; request maior é truncado */
+#define LOG_BATCH    65536   /* bytes por write() da thread de log */
+#define LOG_IDLE_MS     10   /* espera da thread de log com o ring vazio */
+#define METRICS_SLOTS  128   /* blocos de contadores (threads/filhos do modo 0) */
+#define METRICS_BUCKETS 16   /* limites do histograma de latência */
+#define WHEEL_BITS       6   /* 64 posições por nível da roda de prazos */
+#define WHEEL_SIZE     (1 << WHEEL_BITS)
+#define WHEEL_LEVELS     4   /* tick de 1 ms: até 64^4 ms (~4,6 h) */
+#define FD_RESERVE      32   /* fds fora de max_conns: listen, epoll, log... */
+
+/* níveis de log (log_level registra do 0 até ele) */
+enum { LOG_SERVER = 0, LOG_CONN = 1, LOG_REQUEST = 2 };
+
+/* mensagem no ring do log; seq diz de quem é a vez (produtor/consumidor).
+ * O texto só é montado na thread de log: a célula guarda o formato e os
+ * argumentos crus (ver log_pack) */
+struct log_cell {
+    unsigned long seq;
+    time_t sec;
+    const char* fmt;        /* literal do printf: vale até o fim do processo */
+    int len;                /* bytes usados em args */
+    char args[LOG_MSG_MAX];
+};
+
+/* uma conversão %[flags][largura][.precisão][tamanho]tipo de um formato */
+struct log_spec {
+    const char* flags;      /* logo depois do '%' */
+    int nflags;
+    int width, prec;        /* -1 = ausente, -2 = '*' (vem dos argumentos) */
+    char size;              /* 0, 'h', 'H' (hh), 'l' (long e afins), 'q' (long long), 'L' (long double) */
+    char conv;              /* tipo; 'I' = %pI4 (struct in_addr*) */
+    const char* end;        /* depois da conversão */
+};
+
+/* request HTTP analisado sem cópia: cada campo é um slice do buffer da
+ * conexão, com offset relativo ao início do request */
+struct http_slice {
+    unsigned short off, len;
+};
+
+struct http_request {
+    struct http_slice method, path, version;
+    struct http_slice hname[HTTP_MAX_HEADERS];
+    struct http_slice hvalue[HTTP_MAX_HEADERS];
+    int nheaders;
+    int minor_version;      /* 0 = HTTP/1.0, 1 = HTTP/1.1 */
+    int keepalive;          /* padrão da versão ajustado por Connection: */
+    size_t content_length;
+    size_t header_len;      /* bytes até o fim da linha vazia */
+    size_t total_len;       /* header_len + content_length */
+};
+
+/* estado do parser incremental (ver http_parse) */
+enum http_parse_state { HP_REQUEST_LINE, HP_BODY };
+enum { HTTP_TOO_LARGE = -2, HTTP_BAD = -1, HTTP_AGAIN = 0, HTTP_OK = 1 };
+
+struct http_parser {
+    enum http_parse_state state;
+    size_t line_start;      /* início do request (após CRLF soltos) */
+    size_t pos;             /* até onde o fim dos headers já foi procurado */
+    struct http_request req;
+};
+
+/* busca de delimitadores; uma implementação por conjunto de instruções */
+struct scan_impl {
+    const char* name;
+    int (*supported)(void);
+    /* posição logo após a linha vazia que fecha os headers, 0 = ainda não */
+    size_t (*header_end)(const char* buf, size_t len);
+    /* posição do primeiro ':', '\r' ou '\n' (len = nenhum) */
+    size_t (*delims)(const char* buf, size_t len);
+};
+
+/* resposta inteira (status + headers + corpo) serializada em routes_init */
+struct static_response {
+    int status;
+    char* buf;
+    size_t len;
+    size_t date_off;        /* offset da data em buf (0 = sem Date:) */
+};
+
+/* rota estática; path == NULL marca uma resposta de erro */
+struct route {
+    const char* method;
+    const char* path;
+    int status;
+    const char* content_type;
+    const char* body;
+    struct static_response resp[2];  /* [0] fecha a conexão, [1] keep-alive */
+};
+
+/* arquivo aberto no cache de fds de uma thread */
+struct file_entry {
+    char path[FILE_PATH_MAX];   /* relativo ao root */
+    int fd;
+    struct stat st;
+    const char* content_type;
+    long checked_ms;        /* now_ms() do último stat do path */
+    unsigned refs;          /* conexões enviando o arquivo + 1 se em uso */
+    int stale;              /* fora do cache: fecha quando refs chega a 0 */
+    struct file_entry* hnext;            /* bucket */
+    struct file_entry *lprev, *lnext;    /* LRU, mais recente na cabeça */
+};
+
+struct file_cache {
+    struct file_entry* buckets[FILE_CACHE_BUCKETS];
+    struct file_entry *head, *tail;
+    int count;
+};
+
+/* arquivo do content store: headers prontos e corpo, tudo na arena */
+struct store_entry {
+    const char* path;
+    size_t path_len;
+    struct iovec hdr[2];     /* [0] fecha a conexão, [1] keep-alive */
+    size_t date_off[2];      /* offset da data em hdr[k] (0 = sem Date:); ver date_iov */
+    struct iovec body;
+};
+
+struct content_store {
+    int refs;                /* atômico: store_current + uma por store_ref */
+    unsigned gen;
+    char* arena;
+    size_t arena_len;
+    struct store_entry* entries;
+    int nentries;
+    unsigned* seeds;         /* semente do segundo hash de cada balde */
+    int nseeds;
+    int* slots;              /* índice em entries, -1 = vazio */
+    int nslots;
+};
+
+/* uso de um store por uma thread; users conta a thread (enquanto for o
+ * store corrente dela) e as conexões dela com respostas do store em out[] */
+struct store_ref {
+    struct content_store* store;
+    unsigned users;
+};
+
+/* contadores de uma thread; só unsigned long até shared (somados em bloco) */
+struct metrics {
+    unsigned long accepted;
+    unsigned long closed;       /* conexões ativas = accepted - closed */
+    unsigned long requests;
+    unsigned long resp_4xx;
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+    unsigned long errors;
+    unsigned long accept_errors;
+    unsigned long tls_handshakes;
+    unsigned long tls_resumed;
+    unsigned long tls_kernel;   /* handshakes que terminaram com kTLS no envio */
+    unsigned long proxied;      /* requests repassados ao upstream */
+    unsigned long upstream_connects;  /* conexões abertas com o upstream */
+    unsigned long lat_count[METRICS_BUCKETS + 1];   /* último: acima do maior limite */
+    unsigned long lat_sum_us;
+    int shared;                 /* escrito por mais de um processo: soma atômica */
+} __attribute__((aligned(64)));
+
+/* estado de uma conexão nos modos orientados a eventos (1 a 6)
+ *
+ *   READING_HEADERS --(request completo)--> [DELAYED] --> WRITING --+--> DONE
+ *          ^                                                        |
+ *          +-------------------- keep-alive ------------------------+
+ *
+ * DELAYED só existe com sleep_time > 0: o atraso simulado vira um prazo na
+ * roda de prazos do laço, em vez de um sleep que travaria os outros sockets.
+ * Requests em pipeline que já estão no buffer são respondidos juntos, na
+ * ordem em que chegaram, com um único writev(). */
+enum conn_state {
+    CONN_READING_HEADERS,   /* acumulando bytes até o fim dos headers */
+    CONN_DELAYED,           /* respostas prontas, esperando o sleep_time */
+    CONN_WRITING,           /* enviando o que faltar das respostas */
+    CONN_DONE               /* pode fechar */
+};
+
+/* prazo pendente de uma conexão; um por vez, conforme o estado */
+enum timer_kind {
+    TIMER_NONE,
+    TIMER_HEADER,   /* conexão nova ou request começado: header_timeout */
+    TIMER_IDLE,     /* keep-alive esperando o próximo request: keepalive_timeout */
+    TIMER_DELAY,    /* CONN_DELAYED: sleep_time */
+    TIMER_WRITE,    /* envio parado (EAGAIN): write_timeout */
+    TIMER_CLOSE,    /* terminou fora do próprio evento: fecha no fim do lote */
+    TIMER_KINDS
+};
+
+struct conn_timers;
+struct conn_table;
+struct upstream;
+
+struct conn {
+    int fd;
+    enum conn_state state;
+    char* in;               /* buffer de leitura (in_pool, MAXLINE bytes);
+                             * NULL enquanto não há request começado */
+    size_t in_len;          /* bytes válidos em in[] */
+    struct iovec out[4 * MAX_PIPELINE]; /* respostas, na ordem dos requests
+                                         * (até quatro iovecs por resposta) */
+    int out_cnt;            /* entradas usadas em out[] */
+    int out_idx;            /* primeira entrada ainda não enviada por inteiro */
+    int close_after;        /* fecha depois de enviar out[] */
+    unsigned requests;      /* requests atendidos nesta conexão */
+    struct file_entry* file;     /* corpo enviado com sendfile depois de out[] */
+    off_t file_off;
+    size_t file_left;
+    struct store_ref* store;     /* store de onde saíram iovecs de out[] */
+    char* dyn;                   /* resposta montada na hora (malloc), p.ex. /metrics */
+    struct upstream* up;         /* proxy: resposta vem do upstream depois de out[] */
+    unsigned batch;              /* requests respondidos por out[] */
+    long started_us;             /* out[] ficou pronto (latência do /metrics) */
+    unsigned uring_ops;          /* modo 6: bit (1 << UR_*) por operação em andamento */
+    struct msghdr msg;           /* modo 6: sendmsg de out[] */
+    struct http_parser parser;   /* request corrente, retomado a cada leitura */
+    struct ssl_st* ssl;     /* tls=1: sessão TLS (NULL = texto puro) */
+    int tls_flip;           /* o SSL espera o evento oposto ao do estado */
+    int tls_kernel;         /* kTLS no envio: writev/sendfile direto no fd */
+    int tls_failed;         /* erro fatal: fecha sem close_notify */
+    int slot;               /* modo 2: posição no vetor de pollfd */
+    struct conn_table* table;    /* tabela do laço (NULL depois do close no modo 6) */
+    struct conn_timers* timers;  /* roda de prazos do laço dono da conexão */
+    enum timer_kind tkind;       /* prazo pendente (TIMER_NONE = nenhum) */
+    struct conn** tslot;         /* lista da roda em que está (NULL = nenhuma) */
+    struct conn *tprev, *tnext;
+    long expires;           /* now_ms() em que o prazo vence */
+    char hdr[FILE_HDR_MAX]; /* headers da resposta de file */
+    char date[DATE_LEN];    /* Date: das respostas de out[] (ver date_iov) */
+};
+
+/* roda de prazos hierárquica de um laço (ver timer_arm) */
+struct conn_timers {
+    struct conn* slots[WHEEL_LEVELS][WHEEL_SIZE];
+    struct conn* due;       /* já vencidos, esperando conn_timers_expire */
+    long now;               /* último tick (ms) processado */
+    int count;              /* conexões na roda (fora due) */
+    long timeout_ms[TIMER_KINDS];   /* 0 = prazo desligado */
+};
+
+/* conexões abertas de um laço, indexadas pelo fd; by_fd cresce (dobrando)
+ * conforme o kernel entrega fds maiores */
+struct conn_table {
+    struct conn** by_fd;    /* NULL = fd sem conexão deste laço */
+    int cap;                /* posições em by_fd */
+    int count;              /* conexões registradas */
+    int max;                /* max_conns deste laço */
+    int starved;            /* accept falhou com EMFILE/ENFILE: espera um close */
+    int paused;             /* accept pausado (só para logar as transições) */
+};
+
+/* fase de um request do proxy na conexão com o upstream */
+enum upstream_phase {
+    UP_SENDING,     /* mandando o request (o connect pode estar em andamento) */
+    UP_HEAD,        /* lendo status e headers da resposta */
+    UP_BODY         /* repassando o corpo ao cliente */
+};
+
+/* onde está o corpo chunked da resposta do upstream (proxy_chunks) */
+enum chunk_state {
+    CH_SIZE,        /* tamanho do chunk, em hexadecimal */
+    CH_EXT,         /* extensões do chunk, até o fim da linha */
+    CH_DATA,        /* ch_left bytes de dados */
+    CH_DATA_CR,     /* CRLF depois dos dados */
+    CH_DATA_LF,
+    CH_TRAILER,     /* trailer depois do chunk 0, até a linha vazia */
+    CH_DONE,        /* corpo inteiro visto */
+    CH_BAD
+};
+
+/* conexão keep-alive com o upstream do proxy (upstream=); fica no pool da
+ * thread entre requests e, enquanto serve um, guarda o progresso dele */
+struct upstream {
+    int fd;                 /* -1 = fechada, esperando proxy_reap */
+    int pipe[2];            /* splice upstream -> pipe -> cliente (-1 = sem pipe) */
+    enum upstream_phase phase;
+    struct conn* client;    /* NULL = ociosa no pool */
+    struct upstream* next;  /* pool ou lista das fechadas */
+    int reused;             /* veio do pool: falha antes da resposta tenta outra */
+    int keep;               /* resposta delimitada e sem Connection: close */
+    int head_only;          /* HEAD: resposta sem corpo */
+    int http10;             /* cliente HTTP/1.0: corpo chunked vai sem o enquadramento */
+    int chunked;            /* corpo em Transfer-Encoding: chunked */
+    enum chunk_state ch_state;
+    long long ch_left;      /* dados ainda no chunk corrente */
+    int ch_line;            /* dígitos do tamanho / bytes da linha do trailer */
+    size_t req_len, sent;   /* request em req[] e quanto dele já foi */
+    size_t resp_len;        /* bytes lidos em resp[] */
+    long long body_left;    /* corpo ainda no upstream (-1 = até ele fechar) */
+    size_t piped;           /* bytes no pipe ainda não enviados ao cliente */
+    char req[MAXLINE + 512];   /* request remontado (proxy_request) */
+    char resp[MAXLINE];
+};
+
+/* io_uring do modo 6: rings mapeados e buffers de recepção */
+struct uring {
+    int fd;
+    void* ring;
+    size_t ring_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, sq_mask, sq_entries;
+    unsigned tail;                  /* SQEs preenchidos (ainda não publicados) */
+    unsigned *cq_head, *cq_tail, cq_mask;
+    struct io_uring_cqe* cqes;
+    char* bufs;                     /* UR_NBUFS buffers de UR_BUF_SIZE */
+    struct io_uring_buf_ring* br;
+    int accept_armed;               /* accept pendente no kernel */
+    int accept_multi;               /* ... e ele é multishot */
+    int accept_cancel;              /* cancelamento do multishot já pedido */
+};
+
+/* Protocolo UDP do modo 3: cada datagrama começa com este cabeçalho (campos
+ * em ordem de rede). O request leva a rota (route_len bytes) seguida do
+ * payload e tem que caber num datagrama de UDP_FRAG_SIZE. A resposta leva o
+ * mesmo id e o corpo; se não couber num datagrama vai em nfrags pedaços de
+ * UDP_FRAG_DATA bytes (o último menor), remontados pelo cliente pela
+ * posição frag. Datagramas sem o magic recebem a resposta fixa antiga. */
+struct udp_frame {
+    uint16_t magic;         /* UDP_MAGIC */
+    uint8_t version;        /* UDP_VERSION */
+    uint8_t type;           /* UDP_REQUEST ou UDP_REPLY */
+    uint32_t id;            /* escolhido pelo cliente, ecoado na resposta */
+    uint16_t status;        /* resposta: status HTTP */
+    uint16_t route_len;     /* request: bytes de rota antes do payload */
+    uint16_t frag;          /* resposta: índice deste pedaço */
+    uint16_t nfrags;        /* resposta: total de pedaços */
+};
+
+enum { UDP_REQUEST = 1, UDP_REPLY = 2 };
+
+#define UDP_FRAG_DATA (UDP_FRAG_SIZE - sizeof(struct udp_frame))
+
+/* request UDP esperando o sleep_time (copiado: o buffer do lote é reusado) */
+struct udp_pending {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    long due;               /* now_ms() do envio */
+    size_t len;             /* tamanho original (só UDP_FRAG_SIZE copiados) */
+    char data[UDP_FRAG_SIZE];
+};
+
+/* UDP do modo 3: buffers e mensagens de um lote, alocados uma vez */
+struct udp_engine {
+    int fd;
+    int batch;                      /* datagramas por recvmmsg */
+    long delay_ms;                  /* sleep_time */
+    int gso, gro;                   /* offloads ativos neste socket */
+    size_t buf_size;                /* MAXLINE, ou UDP_GRO_BUF com GRO */
+    struct mmsghdr* in;             /* batch mensagens de entrada */
+    struct iovec* in_iov;
+    char* bufs;                     /* batch buffers de buf_size */
+    char* in_ctl;                   /* cmsg de cada entrada (tamanho do GRO) */
+    struct sockaddr_storage* from;
+    struct mmsghdr* out;            /* mensagens do próximo sendmmsg */
+    char* out_ctl;                  /* cmsg UDP_SEGMENT de cada mensagem */
+    int* out_segs;                  /* datagramas em cada mensagem */
+    size_t* out_seg;                /* tamanho do primeiro (segmento do GSO) */
+    size_t* out_bytes;
+    int nout;
+    struct iovec* iov;              /* iovecs de out[], em ordem */
+    int niov, iov_cap;
+    struct udp_frame* hdr;          /* cabeçalhos apontados por iov[] */
+    int nhdr, hdr_cap;
+    struct udp_pending* pend;       /* anel de UDP_PENDING_MAX */
+    unsigned pend_head, pend_tail;
+    const char* tag;
+    pthread_t thread;
+};
+
+/* um laço de eventos epoll; no modo 5 existe um por thread */
+struct reactor {
+    int id;
+    int listenfd;
+    int epfd;
+    int sleep_time;
+    int cpu;            /* CPU em que a thread é fixada, -1 = nenhuma */
+    const char* tag;    /* prefixo dos logs */
+    struct conn_timers timers;
+    struct conn_table table;
+    pthread_t thread;
+};
+
+/* opções extras passadas como chave=valor depois do modo */
+struct server_config {
+    int workers;        /* reactors no modo 5 (0 = CPUs online) */
+    int pin_cpu;        /* 1 = fixa cada reactor em uma CPU */
+    int prefork;        /* filhos criados de início no modo 0 (0 = fork por conexão) */
+    int min_spare;      /* mínimo de filhos ociosos no modo 0 */
+    int max_spare;      /* máximo de filhos ociosos no modo 0 */
+    int max_children;   /* teto do pool do modo 0 */
+    int keepalive_timeout;  /* segundos ociosos antes de fechar */
+    int header_timeout;     /* segundos para o request chegar inteiro */
+    int write_timeout;      /* segundos de envio parado antes de fechar */
+    int keepalive_max;      /* requests por conexão */
+    int max_conns;          /* conexões abertas nos modos 1 a 6 (0 = pelo RLIMIT_NOFILE) */
+    int simd;               /* 0 = força a varredura escalar no parser */
+    int date;               /* 1 = respostas levam Date: (renovado a cada segundo) */
+    const char* root;       /* diretório servido (NULL = só as rotas fixas) */
+    int file_cache;         /* fds abertos mantidos por thread com root= */
+    int store_max;          /* arquivos do root até este tamanho ficam em RAM (0 = não) */
+    int log_level;          /* LOG_SERVER, LOG_CONN ou LOG_REQUEST */
+    int log_sample;         /* registra 1 de cada N mensagens de conexão/request */
+    int metrics;            /* 1 = contadores por thread e rota GET /metrics */
+    int udp_batch;          /* datagramas por recvmmsg/sendmmsg (modo 3) */
+    int udp_workers;        /* threads UDP com SO_REUSEPORT (0 = no laço select) */
+    int udp_offload;        /* 1 = GSO/GRO no UDP quando o kernel suporta */
+    int tls;                /* 1 = HTTPS nos modos 1 a 5 */
+    const char* tls_cert;   /* PEM do certificado (NULL = autoassinado) */
+    const char* tls_key;    /* PEM da chave (NULL = no arquivo do certificado) */
+    int tls_tickets;        /* session tickets por handshake TLS 1.3 */
+    int ktls;               /* 1 = kTLS depois do handshake, se disponível */
+    const char* upstream;   /* HOST:PORTA do proxy reverso (NULL = sem proxy) */
+    const char* proxy;      /* prefixo dos paths repassados (NULL = "/") */
+    int proxy_pool;         /* conexões ociosas com o upstream por thread */
+    int proxy_splice;       /* 1 = corpo do upstream por splice() */
+};
+
+static struct server_config config = {
+    .workers = 0,
+    .pin_cpu = 0,
+    .prefork = 4,
+    .min_spare = 2,
+    .max_spare = 8,
+    .max_children = 64,
+    .keepalive_timeout = 5,
+    .header_timeout = 10,
+    .write_timeout = 10,
+    .keepalive_max = 100,
+    .max_conns = 0,
+    .simd = 1,
+    .date = 1,
+    .root = NULL,
+    .file_cache = 64,
+    .store_max = 0,
+    .log_level = LOG_CONN,
+    .log_sample = 1,
+    .metrics = 1,
+    .udp_batch = 64,
+    .udp_workers = 0,
+    .udp_offload = 1,
+    .tls = 0,
+    .tls_cert = NULL,
+    .tls_key = NULL,
+    .tls_tickets = 2,
+    .ktls = 1,
+    .upstream = NULL,
+    .proxy = NULL,
+    .proxy_pool = 32,
+    .proxy_splice = 1,
+};
+
+/* scoreboard do pool pré-forkado (memória compartilhada com os filhos) */
+enum slot_state { SLOT_FREE, SLOT_STARTING, SLOT_IDLE, SLOT_BUSY };
+
+struct worker_slot {
+    pid_t pid;
+    int state;              /* enum slot_state, escrito pelo filho */
+    int quitting;           /* supervisor já pediu para sair */
+    unsigned long served;   /* conexões atendidas por este filho */
+};
 
 typedef void Sigfunc(int);   
 /* ---------- Prototypes --------------------------------- */
@@ -36,14 +617,49 @@ Sigfunc * Signal(int signo, Sigfunc *func);
 void sig_chld(int signo);
 char* get_time(void);
 void echo_servidor(const char* msg);
+void log_init(void);
+void log_flush(void);
+int log_on(int level);
+void log_text(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_msg(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+void log_request(const char* req, size_t len);
 int Fork(void);
 int Accept(int listenfd);
+int Accept_nb(int listenfd);
+int set_nonblocking(int fd);
 int Close(int connfd);
+int Close_unserved(int connfd);
 int Socket(void);
 void Setsocketopt(int server_fd);
+void Setsocketopt_reuseport(int server_fd);
 struct sockaddr_in Bind(int listenfd, int porta);
-int Write(char* response, int connfd);
-int eh_requisicao_get(const char* request);
+int Write(const char* response, size_t len, int connfd);
+ssize_t Writev(int connfd, struct iovec* iov, int cnt);
+void scan_init(void);
+int slice_eq(const char* base, struct http_slice s, const char* lit);
+void http_parser_init(struct http_parser* p);
+int http_parse(struct http_parser* p, const char* buf, size_t len);
+void routes_init(void);
+void date_tick(long now);
+struct route* route_find(const char* base, const struct http_request* req, int result);
+void files_init(void);
+struct file_entry* file_lookup(const char* base, struct http_slice path);
+void file_release(struct file_entry* f);
+size_t file_header(char* out, size_t cap, const struct file_entry* f, int keepalive);
+void store_init(void);
+int store_sync(void);
+const struct store_entry* store_lookup(const char* base, struct http_slice path);
+void store_ref_put(struct store_ref* r);
+void metrics_init(int mode);
+void tls_init(void);
+void proxy_init(void);
+struct conn* proxy_on_event(void* tagged);
+void proxy_reap(void);
+void metrics_use(int slot);
+void metrics_latency(long us, unsigned n);
+char* metrics_response(int keepalive, size_t* len);
+int metrics_match(const char* base, const struct http_request* req);
+void simulate_delay(int sleep_time);
 void process_request(int connfd, int sleep_time);
 void Listen(int listenfd, int tamanho_fila);
 void log_server_info(int listenfd);
@@ -52,6 +668,39 @@ void log_server_info(int listenfd);
 void server_with_select(int listenfd, int sleep_time);
 void server_with_poll(int listenfd, int sleep_time);
 void server_tcp_udp_select(int listenfd, int udpfd, int sleep_time);
+void udp_engine_init(struct udp_engine* u, int fd, int sleep_time, const char* tag);
+void udp_on_readable(struct udp_engine* u);
+int udp_timeout(const struct udp_engine* u);
+void udp_flush_due(struct udp_engine* u, long now);
+int udp_gro_size(struct msghdr* h);
+void udp_start_workers(int udpfd, int sleep_time);
+void server_with_epoll(int listenfd, int sleep_time);
+void server_with_reuseport(int listenfd, int backlog, int sleep_time);
+void* reactor_run(void* arg);
+int reactor_count(void);
+int server_with_uring(int listenfd, int sleep_time);
+void server_with_fork(int listenfd, int sleep_time);
+void server_with_prefork(int listenfd, int sleep_time);
+void parse_options(int argc, char** argv, int first);
+
+/* máquina de estados por conexão (modos 1 a 6) */
+long now_ms(void);
+long now_us(void);
+void timer_arm(struct conn* c, enum timer_kind kind);
+void timer_cancel(struct conn* c);
+void timer_close(struct conn* c);
+void conn_timers_init(struct conn_timers* t, int sleep_time);
+int conn_timers_timeout(const struct conn_timers* t);
+struct conn* conn_timers_expire(struct conn_timers* t, long now);
+void fd_limit_init(int threads);
+void conn_table_init(struct conn_table* t, int max);
+int conn_table_accepting(struct conn_table* t, const char* tag);
+struct conn* conn_new(int fd, struct conn_timers* timers, struct conn_table* table);
+void conn_free(struct conn* c);
+void conn_on_readable(struct conn* c);
+void conn_on_writable(struct conn* c);
+void conn_on_timer(struct conn* c);
+void conn_drive(struct conn* c);
 
 /* ------------------------------------------------------- */
 
@@ -91,10 +740,633 @@ char* get_time() {
   return ctime(&ticks);
 }
 
-/* echo_servidor com timestamp */
+/* echo_servidor com timestamp (via log assíncrono, nível LOG_SERVER) */
 void echo_servidor(const char* msg) {
-  printf("[SERVIDOR] (%.24s): %s\n", get_time(), msg);
-  fflush(stdout);
+  log_msg(LOG_SERVER, "%s", msg);
+}
+
+/* ------------------ Log assíncrono ------------------ */
+
+/* echo_servidor() e log_msg() não fazem syscall nem formatam: copiam o
+ * ponteiro do formato, a hora e os argumentos crus (inteiros, doubles,
+ * ponteiros, o texto de cada %s) para uma célula de um ring buffer (fila
+ * MPSC sem lock, cada célula com número de sequência) e voltam. Uma thread
+ * de log esvazia o ring em lotes, formata cada mensagem (log_format),
+ * monta "[SERVIDOR] (data): msg" com a data formatada uma vez por segundo e
+ * faz um único write() por lote. Ring cheio descarta a mensagem e conta; o
+ * total aparece no próximo lote. O formato precisa ser um literal, e além
+ * das conversões do printf vale %pI4 (como no kernel): um struct in_addr*
+ * escrito como a.b.c.d, sem inet_ntop no caminho de quem registra.
+ *
+ * log_level escolhe o que é registrado (ver LOG_*) e log_sample=N guarda
+ * em média 1 de cada N mensagens de conexão/request. */
+static struct log_cell log_ring[LOG_RING];
+static unsigned long log_head;          /* próxima célula a reservar (produtores) */
+static unsigned long log_tail;          /* próxima célula a consumir */
+static unsigned long log_dropped;
+static pthread_mutex_t log_consumer = PTHREAD_MUTEX_INITIALIZER;
+static int log_started = 0;
+static __thread unsigned log_rand = 2463534242u;  /* xorshift32 da amostragem */
+
+/* log_on: a mensagem deste nível deve ser registrada? */
+int log_on(int level) {
+    if (level > config.log_level) return 0;
+    if (level == LOG_SERVER || config.log_sample <= 1) return 1;
+    /* sorteio em vez de contador: um contador pegaria sempre a mesma
+     * mensagem do ciclo accept/request/close de cada conexão */
+    log_rand ^= log_rand << 13;
+    log_rand ^= log_rand >> 17;
+    log_rand ^= log_rand << 5;
+    return log_rand % config.log_sample == 0;
+}
+
+/* log_reserve: célula livre para o produtor ou NULL (ring cheio) */
+static struct log_cell* log_reserve(void) {
+    unsigned long pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    for (;;) {
+        struct log_cell* cell = &log_ring[pos % LOG_RING];
+        unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        long diff = (long)(seq - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&log_head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return cell;
+        } else if (diff < 0) {
+            __atomic_add_fetch(&log_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* log_publish: entrega ao consumidor a célula preenchida */
+static void log_publish(struct log_cell* cell) {
+    unsigned long pos = cell->seq;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* log_spec_parse: lê a conversão que começa no '%' em p; 0 se o formato
+ * acabou ou a conversão não é suportada (o resto sai como texto) */
+static int log_spec_parse(const char* p, struct log_spec* s) {
+    p++;
+    s->flags = p;
+    while (*p && strchr("-+ #0", *p)) p++;
+    s->nflags = p - s->flags;
+    s->width = s->prec = -1;
+    if (*p == '*') {
+        s->width = -2;
+        p++;
+    } else if (*p >= '0' && *p <= '9') {
+        s->width = (int)strtol(p, (char**)&p, 10);
+    }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            s->prec = -2;
+            p++;
+        } else {
+            s->prec = (int)strtol(p, (char**)&p, 10);
+        }
+    }
+    s->size = 0;
+    if (*p == 'h') {
+        s->size = p[1] == 'h' ? 'H' : 'h';
+        p += s->size == 'H' ? 2 : 1;
+    } else if (*p == 'l' && p[1] == 'l') {
+        s->size = 'q';
+        p += 2;
+    } else if (*p == 'l' || *p == 'z' || *p == 't') {
+        s->size = 'l';
+        p++;
+    } else if (*p == 'j') {
+        s->size = 'q';
+        p++;
+    } else if (*p == 'L') {
+        s->size = 'L';
+        p++;
+    }
+    if (*p == '\0' || !strchr("diouxXcsfeEgGaAp%", *p)) return 0;
+    s->conv = *p++;
+    if (s->conv == 'p' && p[0] == 'I' && p[1] == '4') {
+        s->conv = 'I';
+        p += 2;
+    }
+    s->end = p;
+    return 1;
+}
+
+/* log_put/log_get: um argumento cru em cell->args */
+static int log_put(struct log_cell* cell, const void* v, size_t len) {
+    if (cell->len + len > sizeof(cell->args)) return 0;
+    memcpy(cell->args + cell->len, v, len);
+    cell->len += len;
+    return 1;
+}
+
+static int log_get(const struct log_cell* cell, int* off, void* v, size_t len) {
+    if (*off + len > (size_t)cell->len) return 0;
+    memcpy(v, cell->args + *off, len);
+    *off += len;
+    return 1;
+}
+
+/* log_pack: guarda os argumentos de fmt em cell->args, na ordem: int para
+ * '*', long long (com ou sem sinal) para inteiros, double ou long double,
+ * ponteiro, 4 bytes para %pI4, e tamanho + bytes para %s (limitado pela
+ * precisão e pelo espaço). Sem espaço, a mensagem para ali. */
+static void log_pack(struct log_cell* cell, const char* fmt, va_list ap) {
+    struct log_spec s;
+    cell->len = 0;
+    for (const char* p = fmt; (p = strchr(p, '%')) != NULL && log_spec_parse(p, &s); p = s.end) {
+        int ok = 1;
+        if (s.width == -2) {
+            int w = va_arg(ap, int);
+            ok = log_put(cell, &w, sizeof(w));
+        }
+        if (s.prec == -2) {
+            s.prec = va_arg(ap, int);
+            ok = ok && log_put(cell, &s.prec, sizeof(s.prec));
+        }
+        switch (s.conv) {
+        case '%':
+            break;
+        case 'd': case 'i': case 'c': {
+            long long v = s.size == 'q' ? va_arg(ap, long long) : s.size == 'l' ? va_arg(ap, long) : va_arg(ap, int);
+            if (s.size == 'h') v = (short)v;        /* h/hh: promovidos a int no va_arg */
+            else if (s.size == 'H') v = (signed char)v;
+            ok = ok && log_put(cell, &v, sizeof(v));
+            break;
+        }
+        case 'o': case 'u': case 'x': case 'X': {
+            unsigned long long v = s.size == 'q' ? va_arg(ap, unsigned long long)
+                                   : s.size == 'l' ? va_arg(ap, unsigned long) : va_arg(ap, unsigned);
+            if (s.size == 'h') v = (unsigned short)v;
+            else if (s.size == 'H') v = (unsigned char)v;
+            ok = ok && log_put(cell, &v, sizeof(v));
+            break;
+        }
+        case 'p': {
+            void* v = va_arg(ap, void*);
+            ok = ok && log_put(cell, &v, sizeof(v));
+            break;
+        }
+        case 'I': {
+            const struct in_addr* a = va_arg(ap, const struct in_addr*);
+            ok = ok && log_put(cell, a, sizeof(*a));
+            break;
+        }
+        case 's': {
+            const char* str = va_arg(ap, const char*);
+            if (str == NULL) str = "(null)";
+            /* deixa lugar para os argumentos que ainda vêm */
+            int room = (int)sizeof(cell->args) - cell->len - (int)sizeof(int) - 64;
+            int n = s.prec >= 0 ? (int)strnlen(str, s.prec) : (int)strlen(str);
+            if (n > room) n = room > 0 ? room : 0;
+            ok = ok && log_put(cell, &n, sizeof(n)) && log_put(cell, str, n);
+            break;
+        }
+        default:
+            if (s.size == 'L') {
+                long double v = va_arg(ap, long double);
+                ok = ok && log_put(cell, &v, sizeof(v));
+            } else {
+                double v = va_arg(ap, double);
+                ok = ok && log_put(cell, &v, sizeof(v));
+            }
+            break;
+        }
+        if (!ok) break;
+    }
+}
+
+/* log_format: texto da mensagem de cell em out (na thread de log), com o
+ * formato percorrido como em log_pack; devolve o tamanho */
+static size_t log_format(const struct log_cell* cell, char* out, size_t cap) {
+    const char* p = cell->fmt;
+    size_t n = 0;
+    int off = 0;
+    struct log_spec s;
+    while (n + 1 < cap) {
+        const char* pct = strchr(p, '%');
+        size_t lit = pct ? (size_t)(pct - p) : strlen(p);
+        if (lit > cap - 1 - n) lit = cap - 1 - n;
+        memcpy(out + n, p, lit);
+        n += lit;
+        if (pct == NULL || n + 1 >= cap || !log_spec_parse(pct, &s)) break;
+        p = s.end;
+        if (s.conv == '%') {
+            out[n++] = '%';
+            continue;
+        }
+
+        /* a conversão de novo, com '*' resolvido e o tamanho do que foi guardado */
+        int w = s.width, pr = s.prec;
+        if (w == -2 && !log_get(cell, &off, &w, sizeof(w))) break;
+        if (pr == -2 && !log_get(cell, &off, &pr, sizeof(pr))) break;
+        char spec[48];
+        int k = snprintf(spec, sizeof(spec), "%%%.*s", s.nflags, s.flags);
+        if (w >= 0) k += snprintf(spec + k, sizeof(spec) - k, "%d", w);
+        if (s.conv == 's' || s.conv == 'I') {
+            snprintf(spec + k, sizeof(spec) - k, ".*s");
+        } else {
+            if (pr >= 0) k += snprintf(spec + k, sizeof(spec) - k, ".%d", pr);
+            const char* size = strchr("diouxXc", s.conv) && s.conv != 'c' ? "ll" : s.size == 'L' ? "L" : "";
+            snprintf(spec + k, sizeof(spec) - k, "%s%c", size, s.conv);
+        }
+
+        size_t room = cap - n;
+        int r = 0;
+        switch (s.conv) {
+        case 'd': case 'i': case 'c': {
+            long long v;
+            if (!log_get(cell, &off, &v, sizeof(v))) goto end;
+            r = s.conv == 'c' ? snprintf(out + n, room, spec, (int)v) : snprintf(out + n, room, spec, v);
+            break;
+        }
+        case 'o': case 'u': case 'x': case 'X': {
+            unsigned long long v;
+            if (!log_get(cell, &off, &v, sizeof(v))) goto end;
+            r = snprintf(out + n, room, spec, v);
+            break;
+        }
+        case 'p': {
+            void* v;
+            if (!log_get(cell, &off, &v, sizeof(v))) goto end;
+            r = snprintf(out + n, room, spec, v);
+            break;
+        }
+        case 'I': {
+            struct in_addr a;
+            char ip[INET_ADDRSTRLEN];
+            if (!log_get(cell, &off, &a, sizeof(a))) goto end;
+            inet_ntop(AF_INET, &a, ip, sizeof(ip));
+            r = snprintf(out + n, room, spec, (int)strlen(ip), ip);
+            break;
+        }
+        case 's': {
+            int len;
+            if (!log_get(cell, &off, &len, sizeof(len)) || off + len > cell->len) goto end;
+            r = snprintf(out + n, room, spec, len, cell->args + off);
+            off += len;
+            break;
+        }
+        default:
+            if (s.size == 'L') {
+                long double v;
+                if (!log_get(cell, &off, &v, sizeof(v))) goto end;
+                r = snprintf(out + n, room, spec, v);
+            } else {
+                double v;
+                if (!log_get(cell, &off, &v, sizeof(v))) goto end;
+                r = snprintf(out + n, room, spec, v);
+            }
+            break;
+        }
+        if (r < 0) break;
+        n += (size_t)r < room ? (size_t)r : room - 1;
+    }
+end:
+    out[n] = '\0';
+    return n;
+}
+
+static void log_vmsg(const char* fmt, va_list ap) {
+    struct log_cell* cell = log_reserve();
+    if (cell == NULL) return;
+    cell->sec = time(NULL);
+    cell->fmt = fmt;
+    log_pack(cell, fmt, ap);
+    log_publish(cell);
+}
+
+/* log_text: registra sem testar o nível (depois de um log_on) */
+void log_text(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vmsg(fmt, ap);
+    va_end(ap);
+}
+
+/* log_msg: registra a mensagem se o nível estiver ativo; o teste vem
+ * antes de formatar, então nível desligado custa uma comparação */
+void log_msg(int level, const char* fmt, ...) {
+    if (!log_on(level)) return;
+    va_list ap;
+    va_start(ap, fmt);
+    log_vmsg(fmt, ap);
+    va_end(ap);
+}
+
+/* log_request: registra o request cru (nível LOG_REQUEST) */
+void log_request(const char* req, size_t len) {
+    if (log_on(LOG_REQUEST)) log_text("request recebido | msg:\n%.*s", (int)len, req);
+}
+
+static void log_write_all(const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/* log_drain: formata e escreve o que houver no ring; devolve quantas
+ * mensagens saíram. Só um consumidor por vez (a thread de log ou quem
+ * estiver saindo do processo). */
+static int log_drain(void) {
+    static char out[LOG_BATCH];
+    static time_t stamp_sec = -1;
+    static char stamp[32];
+    int count = 0;
+    size_t used = 0;
+
+    pthread_mutex_lock(&log_consumer);
+    unsigned long dropped = __atomic_exchange_n(&log_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped)
+        used += snprintf(out, sizeof(out), "[log] %lu mensagens descartadas (ring cheio)\n", dropped);
+    for (;;) {
+        struct log_cell* cell = &log_ring[log_tail % LOG_RING];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != log_tail + 1) break;
+        if (used + LOG_MSG_MAX + 64 > sizeof(out)) {
+            log_write_all(out, used);
+            used = 0;
+        }
+        if (cell->sec != stamp_sec) {
+            stamp_sec = cell->sec;
+            ctime_r(&stamp_sec, stamp);
+        }
+        used += snprintf(out + used, sizeof(out) - used, "[SERVIDOR] (%.24s): ", stamp);
+        used += log_format(cell, out + used, LOG_MSG_MAX);
+        out[used++] = '\n';
+        __atomic_store_n(&cell->seq, log_tail + LOG_RING, __ATOMIC_RELEASE);
+        log_tail++;
+        count++;
+    }
+    if (used) log_write_all(out, used);
+    pthread_mutex_unlock(&log_consumer);
+    return count;
+}
+
+static void* log_thread(void* arg) {
+    (void)arg;
+    for (;;) {
+        if (log_drain() == 0) {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = LOG_IDLE_MS * 1000000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+    return NULL;
+}
+
+static void log_start_thread(void) {
+    pthread_t tid;
+    sigset_t all, old;
+    /* a thread de log não deve receber os sinais do servidor */
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if (pthread_create(&tid, NULL, log_thread, NULL) == 0) pthread_detach(tid);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* no filho de fork() só existe a thread que chamou fork: as mensagens
+ * pendentes são do pai (que as escreve) e o filho precisa de outra
+ * thread de log */
+static void log_atfork_child(void) {
+    pthread_mutex_init(&log_consumer, NULL);
+    for (unsigned long p = log_tail; p != log_head; p++)
+        log_ring[p % LOG_RING].seq = p + LOG_RING;
+    log_tail = log_head;
+    log_dropped = 0;
+    log_start_thread();
+}
+
+/* log_flush: escreve o que faltar (atexit) */
+void log_flush(void) {
+    while (log_drain() > 0)
+        ;
+}
+
+/* log_init: prepara o ring e inicia a thread de log */
+void log_init(void) {
+    if (log_started) return;
+    log_started = 1;
+    for (unsigned long i = 0; i < LOG_RING; i++) log_ring[i].seq = i;
+    /* printf direto (partida, SIGCHLD) continua no stdout: sem buffer de
+     * bloco, para não sair fora de ordem com os lotes do log */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    pthread_atfork(NULL, NULL, log_atfork_child);
+    atexit(log_flush);
+    log_start_thread();
+}
+
+/* ------------------ Métricas (GET /metrics) ------------------ */
+
+/* Cada thread (ou processo do modo 0) soma nos seus próprios contadores,
+ * num bloco alinhado à linha de cache: não há lock nem instrução atômica
+ * com LOCK no caminho do request, e threads vizinhas não disputam a mesma
+ * linha. Quem atende o /metrics soma todos os blocos com leituras relaxed;
+ * cada contador só cresce, então o total pode estar um instante atrasado,
+ * mas nunca volta. Os blocos ficam em memória compartilhada, assim os
+ * filhos do modo 0 somam no mesmo lugar que o processo que responde. */
+static const long metrics_bounds_us[METRICS_BUCKETS] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+    100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+};
+
+static struct metrics* metrics_table;   /* METRICS_SLOTS blocos (mmap compartilhado) */
+static unsigned* metrics_claimed;       /* próximo slot livre (compartilhado) */
+static __thread struct metrics* metrics_tls;
+static int server_mode;                 /* rótulo mode="N" */
+
+/* metrics_init: aloca os blocos (chamar antes de fork/threads) */
+void metrics_init(int mode) {
+    server_mode = mode;
+    if (!config.metrics) return;
+    size_t len = (METRICS_SLOTS + 1) * sizeof(struct metrics);
+    void* p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap metrics");
+        exit(1);
+    }
+    /* o bloco extra no fim guarda só o contador de slots, em linha própria */
+    metrics_table = p;
+    metrics_claimed = (unsigned*)&metrics_table[METRICS_SLOTS];
+    *metrics_claimed = 1;
+    /* slot 0: compartilhado (fork por conexão e excedentes), soma atômica */
+    metrics_table[0].shared = 1;
+}
+
+/* metrics_use: fixa o slot da thread corrente (filhos do modo 0); fora
+ * do intervalo usa o slot compartilhado */
+void metrics_use(int slot) {
+    if (metrics_table == NULL) return;
+    metrics_tls = &metrics_table[slot > 0 && slot < METRICS_SLOTS ? slot : 0];
+}
+
+/* metrics_self: bloco da thread corrente, reservado no primeiro uso */
+static struct metrics* metrics_self(void) {
+    if (metrics_tls == NULL) {
+        unsigned slot = __atomic_fetch_add(metrics_claimed, 1, __ATOMIC_RELAXED);
+        metrics_use(slot);
+    }
+    return metrics_tls;
+}
+
+/* metrics_add: só o dono escreve no bloco, então load + store basta; o
+ * store relaxed só garante que o leitor não veja um valor rasgado */
+static inline void metrics_add(struct metrics* m, unsigned long* v, unsigned long n) {
+    if (m->shared) __atomic_fetch_add(v, n, __ATOMIC_RELAXED);
+    else __atomic_store_n(v, *v + n, __ATOMIC_RELAXED);
+}
+
+#define METRIC_ADD(field, n) do {                        \
+        if (metrics_table) {                             \
+            struct metrics* m_ = metrics_self();         \
+            metrics_add(m_, &m_->field, (n));            \
+        }                                                \
+    } while (0)
+
+/* metrics_latency: n requests respondidos em us microssegundos cada */
+void metrics_latency(long us, unsigned n) {
+    if (metrics_table == NULL || n == 0) return;
+    struct metrics* m = metrics_self();
+    int b = 0;
+    while (b < METRICS_BUCKETS && us > metrics_bounds_us[b]) b++;
+    metrics_add(m, &m->lat_count[b], n);
+    metrics_add(m, &m->lat_sum_us, (unsigned long)us * n);
+}
+
+/* listen_overflows: TcpExt ListenOverflows do /proc/net/netstat (o kernel
+ * só conta por host: é a fila de accept cheia de qualquer socket) */
+static long listen_overflows(void) {
+    FILE* f = fopen("/proc/net/netstat", "r");
+    if (f == NULL) return -1;
+    char names[4096], values[4096];
+    long result = -1;
+    while (result < 0 && fgets(names, sizeof(names), f) && fgets(values, sizeof(values), f)) {
+        if (strncmp(names, "TcpExt:", 7) != 0) continue;
+        char *sn, *sv;
+        char* n = strtok_r(names, " \n", &sn);
+        char* v = strtok_r(values, " \n", &sv);
+        while (n && v) {
+            if (strcmp(n, "ListenOverflows") == 0) {
+                result = atol(v);
+                break;
+            }
+            n = strtok_r(NULL, " \n", &sn);
+            v = strtok_r(NULL, " \n", &sv);
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+/* metrics_printf: acrescenta ao texto em out[0..*n), sem passar de cap */
+static void metrics_printf(char* out, size_t cap, size_t* n, const char* fmt, ...) {
+    if (*n >= cap) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int k = vsnprintf(out + *n, cap - *n, fmt, ap);
+    va_end(ap);
+    if (k > 0) *n += (size_t)k < cap - *n ? (size_t)k : cap - *n;
+}
+
+/* metrics_counter: uma métrica counter/gauge no formato texto do Prometheus */
+static void metrics_counter(char* out, size_t cap, size_t* n, const char* name, const char* type,
+                            const char* help, unsigned long value) {
+    metrics_printf(out, cap, n, "# HELP %s %s\n# TYPE %s %s\n%s{mode=\"%d\"} %lu\n",
+                   name, help, name, type, name, server_mode, value);
+}
+
+/* metrics_response: resposta inteira do GET /metrics em um buffer novo
+ * (malloc; *len recebe o tamanho) */
+char* metrics_response(int keepalive, size_t* len) {
+    struct metrics sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < METRICS_SLOTS; i++) {
+        const unsigned long* src = (const unsigned long*)&metrics_table[i];
+        unsigned long* dst = (unsigned long*)&sum;
+        for (size_t k = 0; k < offsetof(struct metrics, shared) / sizeof(unsigned long); k++)
+            dst[k] += __atomic_load_n(&src[k], __ATOMIC_RELAXED);
+    }
+
+    char body[8192];
+    size_t n = 0, cap = sizeof(body);
+    metrics_counter(body, cap, &n, "http_connections_accepted_total", "counter",
+                    "Conexoes aceitas.", sum.accepted);
+    metrics_counter(body, cap, &n, "http_connections_active", "gauge",
+                    "Conexoes abertas agora.", sum.accepted - sum.closed);
+    metrics_counter(body, cap, &n, "http_requests_total", "counter",
+                    "Requests respondidos.", sum.requests);
+    metrics_counter(body, cap, &n, "http_responses_4xx_total", "counter",
+                    "Respostas 4xx.", sum.resp_4xx);
+    metrics_counter(body, cap, &n, "http_received_bytes_total", "counter",
+                    "Bytes lidos dos clientes.", sum.bytes_in);
+    metrics_counter(body, cap, &n, "http_sent_bytes_total", "counter",
+                    "Bytes enviados aos clientes.", sum.bytes_out);
+    metrics_counter(body, cap, &n, "http_errors_total", "counter",
+                    "Erros de leitura/escrita em conexoes.", sum.errors);
+    metrics_counter(body, cap, &n, "http_accept_errors_total", "counter",
+                    "Falhas de accept (EMFILE, ENFILE, ...).", sum.accept_errors);
+    if (config.tls) {
+        metrics_counter(body, cap, &n, "tls_handshakes_total", "counter",
+                        "Handshakes TLS completos.", sum.tls_handshakes);
+        metrics_counter(body, cap, &n, "tls_resumed_total", "counter",
+                        "Handshakes com sessao retomada (ticket ou cache).", sum.tls_resumed);
+        metrics_counter(body, cap, &n, "tls_ktls_total", "counter",
+                        "Handshakes que passaram o envio ao kernel (kTLS).", sum.tls_kernel);
+    }
+    if (config.upstream) {
+        metrics_counter(body, cap, &n, "proxy_requests_total", "counter",
+                        "Requests repassados ao upstream.", sum.proxied);
+        metrics_counter(body, cap, &n, "proxy_upstream_connects_total", "counter",
+                        "Conexoes abertas com o upstream (o resto veio do pool).",
+                        sum.upstream_connects);
+    }
+    long overflows = listen_overflows();
+    if (overflows >= 0)
+        metrics_counter(body, cap, &n, "tcp_listen_overflows_total", "counter",
+                        "Fila de accept cheia (TcpExt ListenOverflows, todo o host).",
+                        (unsigned long)overflows);
+
+    const char* h = "http_request_duration_seconds";
+    metrics_printf(body, cap, &n, "# HELP %s Do request completo ao ultimo byte da resposta.\n"
+                   "# TYPE %s histogram\n", h, h);
+    unsigned long cum = 0;
+    for (int b = 0; b < METRICS_BUCKETS; b++) {
+        cum += sum.lat_count[b];
+        metrics_printf(body, cap, &n, "%s_bucket{mode=\"%d\",le=\"%g\"} %lu\n",
+                       h, server_mode, metrics_bounds_us[b] / 1e6, cum);
+    }
+    cum += sum.lat_count[METRICS_BUCKETS];
+    metrics_printf(body, cap, &n, "%s_bucket{mode=\"%d\",le=\"+Inf\"} %lu\n", h, server_mode, cum);
+    metrics_printf(body, cap, &n, "%s_sum{mode=\"%d\"} %.6f\n%s_count{mode=\"%d\"} %lu\n",
+                   h, server_mode, sum.lat_sum_us / 1e6, h, server_mode, cum);
+
+    char head[256];
+    int hn = snprintf(head, sizeof(head),
+                      "HTTP/1.1 200 OK\r\n"
+                      "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                      "Content-Length: %zu\r\n"
+                      "Connection: %s\r\n"
+                      "Cache-Control: no-cache\r\n\r\n",
+                      n, keepalive ? "keep-alive" : "close");
+    char* resp = malloc(hn + n);
+    if (resp == NULL) return NULL;
+    memcpy(resp, head, hn);
+    memcpy(resp + hn, body, n);
+    *len = hn + n;
+    return resp;
+}
+
+/* metrics_match: o request é GET /metrics e o endpoint está ligado? */
+int metrics_match(const char* base, const struct http_request* req) {
+    return metrics_table && slice_eq(base, req->path, "/metrics") && slice_eq(base, req->method, "GET");
 }
 
 /* Fork wrapper */
@@ -106,28 +1378,45 @@ int Fork() {
   return pid;
 }
 
-/* Accept wrapper (retorna -1 em erro) */
-int Accept(int listenfd) {
+/* accept_and_log: accept4 com flags e log do cliente (retorna -1 em erro) */
+static int accept_and_log(int listenfd, int flags) {
   struct sockaddr_in cliaddr;
   memset(&cliaddr, 0, sizeof(cliaddr));
   socklen_t cliaddr_len = sizeof(cliaddr);
   int file_descriptor;
-  if ((file_descriptor = accept(listenfd, (struct sockaddr *)&cliaddr, &cliaddr_len)) < 0) {
+  if ((file_descriptor = accept4(listenfd, (struct sockaddr *)&cliaddr, &cliaddr_len, flags)) < 0) {
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+      METRIC_ADD(accept_errors, 1);
     return -1;
   }
+  METRIC_ADD(accepted, 1);
 
-  char cli_ip[INET_ADDRSTRLEN];
-  inet_ntop(AF_INET, &cliaddr.sin_addr, cli_ip, sizeof(cli_ip));
-  int cli_port = ntohs(cliaddr.sin_port);
-
-  char cli_info[INET_ADDRSTRLEN + 64];
-  snprintf(cli_info, sizeof(cli_info), "nova conexão aceita, cliente: %s:%d (fd=%d)",
-           cli_ip, cli_port, file_descriptor);
-  echo_servidor(cli_info);
+  log_msg(LOG_CONN, "nova conexão aceita, cliente: %pI4:%d (fd=%d)", &cliaddr.sin_addr,
+          ntohs(cliaddr.sin_port), file_descriptor);
 
   return file_descriptor;
 }
 
+/* Accept wrapper (retorna -1 em erro) */
+int Accept(int listenfd) {
+  return accept_and_log(listenfd, 0);
+}
+
+/* Accept_nb: igual a Accept, mas o socket aceito já nasce non-blocking */
+int Accept_nb(int listenfd) {
+  return accept_and_log(listenfd, SOCK_NONBLOCK);
+}
+
+/* set_nonblocking: liga O_NONBLOCK em fd */
+int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    perror("fcntl => erro: não foi possível tornar o fd non-blocking");
+    return -1;
+  }
+  return 0;
+}
+
 /* Close wrapper */
 int Close(int connfd) {
   int sucesso;
@@ -137,6 +1426,13 @@ int Close(int connfd) {
   return sucesso;
 }
 
+/* Close_unserved: fecha uma conexão aceita que não chegou a ser atendida
+ * (conta como fechada nas métricas) */
+int Close_unserved(int connfd) {
+  METRIC_ADD(closed, 1);
+  return Close(connfd);
+}
+
 /* Socket para stream (original) */
 int Socket() {
   int listenfd;
@@ -156,6 +1452,15 @@ void Setsocketopt(int server_fd) {
   return;
 }
 
+/* setsockopt: SO_REUSEPORT (vários sockets escutando na mesma porta) */
+void Setsocketopt_reuseport(int server_fd) {
+  int opt = 1;
+  if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+      perror("setsockopt SO_REUSEPORT failed");
+  }
+  return;
+}
+
 /* Bind: faz bind e retorna struct servaddr (para obter porto se porta 0) */
 struct sockaddr_in Bind(int listenfd, int porta) {
   struct sockaddr_in servaddr;
@@ -172,299 +1477,4205 @@ struct sockaddr_in Bind(int listenfd, int porta) {
   return servaddr;
 }
 
-/* Write: escreve resposta no connfd */
-int Write(char* response, int connfd) {
+/* Write: escreve os len bytes de response no connfd, retomando depois de
+ * escritas parciais; -1 se não foi tudo (erro ou SO_SNDTIMEO) */
+int Write(const char* response, size_t len, int connfd) {
   if (response == NULL) return -1;
-  return write(connfd, response, strlen(response));
+  size_t done = 0;
+  while (done < len) {
+    ssize_t n = write(connfd, response + done, len - done);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    done += n;
+  }
+  return (int)done;
+}
+
+/* Writev: como Write, para os cnt iovecs de iov (que são alterados) */
+ssize_t Writev(int connfd, struct iovec* iov, int cnt) {
+  ssize_t total = 0;
+  while (cnt > 0) {
+    ssize_t n = writev(connfd, iov, cnt);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return -1;
+    }
+    total += n;
+    /* avança sobre os iovecs inteiros; o parcial é ajustado */
+    while (cnt > 0 && (size_t)n >= iov->iov_len) {
+      n -= iov->iov_len;
+      iov++;
+      cnt--;
+    }
+    if (cnt > 0) {
+      iov->iov_base = (char*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return total;
 }
 
-/* verifica se request é GET / */
-int eh_requisicao_get(const char* request) {
-    const char* get_http_1   = "GET / HTTP/1.0";
-    const char* get_http_1_1 = "GET / HTTP/1.1";
-    return (request && (strstr(request, get_http_1) != NULL || strstr(request, get_http_1_1) != NULL));
+/* ------------------ Varredura de delimitadores (SIMD) ------------------ */
+
+/* Duas buscas dominam o caminho do request: o fim do bloco de headers
+ * (linha vazia) e o ':' que separa nome e valor de cada header. Cada uma
+ * tem versão escalar, SSE4.2 e AVX2; scan_init() escolhe a melhor que a
+ * CPU suporta. As versões vetoriais só leem blocos inteiros dentro de
+ * buf[0..len) e terminam o resto com o laço escalar. */
+
+/* header_end_at: tamanho da quebra de linha vazia que começa no '\n' em
+ * buf[i] ("\n\n" ou "\n\r\n"), 0 se não houver */
+static inline size_t header_end_at(const char* buf, size_t len, size_t i) {
+    if (i + 1 < len && buf[i + 1] == '\n') return 2;
+    if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') return 3;
+    return 0;
 }
 
-/* process_request: dorme sleep_time segundos e responde */
-void process_request(int connfd, int sleep_time) {
-    if (sleep_time > 0) {
-        struct timespec ts;
-        ts.tv_sec = sleep_time;
-        ts.tv_nsec = 0;
-        nanosleep(&ts, NULL);
+static size_t scan_header_end_scalar(const char* buf, size_t len) {
+    const char* p = buf;
+    const char* end = buf + len;
+    while ((p = memchr(p, '\n', end - p)) != NULL) {
+        size_t k = header_end_at(buf, len, p - buf);
+        if (k) return (p - buf) + k;
+        p++;
     }
+    return 0;
+}
 
-    char request[MAXLINE + 1];
-    ssize_t n = read(connfd, request, MAXLINE);
-    if (n > 0) {
-        request[n] = '\0';
-        echo_servidor("request recebido | msg:");
-        fputs(request, stdout);
-        fflush(stdout);
-
-        char* response;
-        if (eh_requisicao_get(request)) {
-            response = "HTTP/1.0 200 OK\r\n"
-                       "Content-Type: text/html\r\n"
-                       "Content-Length: 91\r\n"
-                       "Connection: close\r\n"
-                       "\r\n"
-                       "<html><head><title>MC833</title></head><body><h1>MC833</h1></body></html>";
-        } else {
-            response = "400 Bad Request\n";
-        }
-        if (Write(response, connfd) == -1) {
-            perror("write => erro: não foi possível enviar a mensagem ao cliente");
-        }
-    } else if (n == 0) {
-        /* cliente fechou sem enviar nada */
-    } else {
-        perror("read");
+static size_t scan_delims_scalar(const char* buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char ch = buf[i];
+        if (ch == ':' || ch == '\r' || ch == '\n') return i;
     }
+    return len;
 }
 
-/* Listen wrapper */
-void Listen(int listenfd, int tamanho_fila) {
-  if (listen(listenfd, tamanho_fila) == -1) {
-      perror("listen => erro: não foi possível ativar o listening socket");
-      close(listenfd);
-      exit(1);
-  }
+#if defined(__x86_64__) || defined(__i386__)
+
+/* SSE4.2: PCMPESTRI compara 16 bytes contra o conjunto {':', '\r', '\n'} */
+__attribute__((target("sse4.2")))
+static size_t scan_delims_sse42(const char* buf, size_t len) {
+    const __m128i set = _mm_setr_epi8(':', '\r', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(buf + i));
+        int idx = _mm_cmpestri(set, 3, chunk, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) return i + idx;
+    }
+    return i + scan_delims_scalar(buf + i, len - i);
 }
 
-/* log_server_info: grava server.info com IP e PORT */
-void log_server_info(int listenfd) {
-  struct sockaddr_in bound; socklen_t blen = sizeof(bound);
-  if (getsockname(listenfd, (struct sockaddr*)&bound, &blen) == 0) {
-      unsigned short p = ntohs(bound.sin_port);
-      printf("[SERVIDOR] Escutando em 0.0.0.0:%u\n", p);
-      FILE *f = fopen("server.info", "w");
-      if (f) { fprintf(f, "IP=127.0.0.1\nPORT=%u\n", p); fclose(f); }
-      fflush(stdout);
-  }
+/* SSE: '\n' seguido de '\n' ou de "\r\n", 16 posições por vez */
+__attribute__((target("sse4.2")))
+static size_t scan_header_end_sse42(const char* buf, size_t len) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 16 + 2 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(buf + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(buf + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(buf + i + 2));
+        __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, nl),
+                        _mm_or_si128(_mm_cmpeq_epi8(b, nl),
+                                     _mm_and_si128(_mm_cmpeq_epi8(b, cr), _mm_cmpeq_epi8(c, nl))));
+        unsigned mask = (unsigned)_mm_movemask_epi8(m);
+        if (mask) {
+            size_t k = i + __builtin_ctz(mask);
+            return k + header_end_at(buf, len, k);
+        }
+    }
+    size_t r = scan_header_end_scalar(buf + i, len - i);
+    return r ? i + r : 0;
 }
 
-/* ------------------ Implementações de multiplexação ------------------ */
+/* AVX2: mesmas buscas, 32 bytes por vez */
+__attribute__((target("avx2")))
+static size_t scan_delims_avx2(const char* buf, size_t len) {
+    const __m256i colon = _mm256_set1_epi8(':');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, nl)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + scan_delims_scalar(buf + i, len - i);
+}
 
-/* servidor usando select() — single-process */
-void server_with_select(int listenfd, int sleep_time) {
-    int maxfd, i;
-    int clients[FD_SETSIZE]; /* -1 = free */
-    fd_set allset, rset;
+__attribute__((target("avx2")))
+static size_t scan_header_end_avx2(const char* buf, size_t len) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+    for (; i + 32 + 2 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(buf + i + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(buf + i + 2));
+        __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(a, nl),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(b, nl),
+                                        _mm256_and_si256(_mm256_cmpeq_epi8(b, cr), _mm256_cmpeq_epi8(c, nl))));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(m);
+        if (mask) {
+            size_t k = i + __builtin_ctz(mask);
+            return k + header_end_at(buf, len, k);
+        }
+    }
+    size_t r = scan_header_end_scalar(buf + i, len - i);
+    return r ? i + r : 0;
+}
 
-    for (i = 0; i < FD_SETSIZE; i++) clients[i] = -1;
+static int cpu_has_avx2(void)  { return __builtin_cpu_supports("avx2"); }
+static int cpu_has_sse42(void) { return __builtin_cpu_supports("sse4.2"); }
 
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    maxfd = listenfd;
+#endif /* x86 */
 
-    char buf[128];
-    snprintf(buf, sizeof(buf), "[select] pid=%d modo select iniciado (listenfd=%d)", (int)getpid(), listenfd);
-    echo_servidor(buf);
+static int cpu_always(void) { return 1; }
+
+/* implementações em ordem de preferência */
+const struct scan_impl scan_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+    { "avx2",   cpu_has_avx2,  scan_header_end_avx2,  scan_delims_avx2 },
+    { "sse4.2", cpu_has_sse42, scan_header_end_sse42, scan_delims_sse42 },
+#endif
+    { "scalar", cpu_always,    scan_header_end_scalar, scan_delims_scalar },
+};
+const int scan_nimpls = sizeof(scan_impls) / sizeof(scan_impls[0]);
+
+/* implementação em uso (escalar até scan_init rodar) */
+const struct scan_impl* scan = &scan_impls[sizeof(scan_impls) / sizeof(scan_impls[0]) - 1];
+
+/* scan_init: escolhe a implementação pela CPU; config.simd=0 força a escalar */
+void scan_init(void) {
+    for (int i = 0; i < scan_nimpls; i++) {
+        if (scan_impls[i].supported() && (config.simd || i == scan_nimpls - 1)) {
+            scan = &scan_impls[i];
+            return;
+        }
+    }
+}
+
+/* ------------------ Parser HTTP incremental ------------------ */
+
+/* slice_eq: compara um slice do buffer com uma string literal */
+int slice_eq(const char* base, struct http_slice s, const char* lit) {
+    size_t n = strlen(lit);
+    return s.len == n && memcmp(base + s.off, lit, n) == 0;
+}
+
+void http_parser_init(struct http_parser* p) {
+    p->state = HP_REQUEST_LINE;
+    p->line_start = 0;
+    p->pos = 0;
+    memset(&p->req, 0, sizeof(p->req));
+}
+
+/* caracteres de token do RFC 9110 (nomes de método e de header) */
+static const unsigned char tchar[256] = {
+    ['!'] = 1, ['#'] = 1, ['$'] = 1, ['%'] = 1, ['&'] = 1, ['\''] = 1, ['*'] = 1,
+    ['+'] = 1, ['-'] = 1, ['.'] = 1, ['^'] = 1, ['_'] = 1, ['`'] = 1, ['|'] = 1, ['~'] = 1,
+    ['0' ... '9'] = 1, ['A' ... 'Z'] = 1, ['a' ... 'z'] = 1,
+};
+
+static int is_tchar(unsigned char ch) {
+    return tchar[ch];
+}
+
+/* has_word: s[0..n) contém w, sem diferenciar maiúsculas? */
+static int has_word(const char* s, size_t n, const char* w) {
+    size_t wl = strlen(w);
+    for (size_t i = 0; i + wl <= n; i++) {
+        if (strncasecmp(s + i, w, wl) == 0) return 1;
+    }
+    return 0;
+}
+
+/* http_parse_request_line: "METODO SP alvo SP HTTP/1.x" em buf[s..e) */
+static int http_parse_request_line(struct http_request* req, const char* buf, size_t s, size_t e) {
+    size_t i = s;
+    while (i < e && is_tchar((unsigned char)buf[i])) i++;
+    if (i == s || i >= e || buf[i] != ' ') return HTTP_BAD;
+    req->method.off = s;
+    req->method.len = i - s;
+
+    size_t t = ++i;
+    while (i < e && buf[i] != ' ' && (unsigned char)buf[i] > 0x20 && buf[i] != 0x7f) i++;
+    if (i == t || i >= e || buf[i] != ' ') return HTTP_BAD;
+    req->path.off = t;
+    req->path.len = i - t;
+
+    i++;
+    if (e - i != 8 || memcmp(buf + i, "HTTP/1.", 7) != 0) return HTTP_BAD;
+    if (buf[i + 7] != '0' && buf[i + 7] != '1') return HTTP_BAD;
+    req->version.off = i;
+    req->version.len = 8;
+    req->minor_version = buf[i + 7] - '0';
+    req->keepalive = (req->minor_version == 1);
+    return HTTP_OK;
+}
+
+/* http_parse_header_line: "nome: valor" em buf[s..e) */
+static int http_parse_header_line(struct http_request* req, const char* buf, size_t s, size_t e) {
+    size_t i = s + scan->delims(buf + s, e - s);
+    if (i == s || i >= e || buf[i] != ':') return HTTP_BAD;
+    for (size_t k = s; k < i; k++) {
+        if (!is_tchar((unsigned char)buf[k])) return HTTP_BAD;
+    }
+    if (req->nheaders == HTTP_MAX_HEADERS) return HTTP_TOO_LARGE;
+
+    struct http_slice name = { s, i - s };
+    i++;
+    while (i < e && (buf[i] == ' ' || buf[i] == '\t')) i++;
+    while (e > i && (buf[e - 1] == ' ' || buf[e - 1] == '\t')) e--;
+    struct http_slice value = { i, e - i };
+    req->hname[req->nheaders] = name;
+    req->hvalue[req->nheaders] = value;
+    req->nheaders++;
+
+    /* headers que mudam o enquadramento ou a conexão */
+    if (name.len == 10 && strncasecmp(buf + name.off, "Connection", 10) == 0) {
+        if (has_word(buf + value.off, value.len, "close"))
+            req->keepalive = 0;
+        else if (has_word(buf + value.off, value.len, "keep-alive"))
+            req->keepalive = 1;
+    } else if (name.len == 14 && strncasecmp(buf + name.off, "Content-Length", 14) == 0) {
+        size_t cl = 0;
+        if (value.len == 0 || value.len > 9) return HTTP_BAD;
+        for (size_t k = 0; k < value.len; k++) {
+            char d = buf[value.off + k];
+            if (d < '0' || d > '9') return HTTP_BAD;
+            cl = cl * 10 + (d - '0');
+        }
+        req->content_length = cl;
+    } else if (name.len == 17 && strncasecmp(buf + name.off, "Transfer-Encoding", 17) == 0) {
+        return HTTP_BAD; /* corpo chunked não é suportado */
+    }
+    return HTTP_OK;
+}
+
+/* http_parse: avança o parser sobre buf[0..len), que começa no início do
+ * request e pode ter crescido desde a chamada anterior.
+ *
+ * Primeiro o fim do bloco de headers é procurado (scan->header_end),
+ * retomando de onde a chamada anterior parou, então bytes que chegam aos
+ * poucos são varridos uma vez só. Com o bloco completo as linhas são
+ * separadas uma única vez; nada é copiado: método, alvo, versão e headers
+ * ficam como slices (offset, tamanho) em buf.
+ *
+ * Devolve HTTP_OK (request completo, total em req.total_len), HTTP_AGAIN
+ * (faltam bytes), HTTP_BAD ou HTTP_TOO_LARGE (headers além do limite). */
+int http_parse(struct http_parser* p, const char* buf, size_t len) {
+    struct http_request* req = &p->req;
+
+    if (p->state == HP_REQUEST_LINE) {
+        /* tolera CRLF solto antes do request (RFC 9112, 2.2) */
+        while (p->line_start < len && p->line_start < 4
+               && (buf[p->line_start] == '\r' || buf[p->line_start] == '\n'))
+            p->line_start++;
+        if (p->pos < p->line_start) p->pos = p->line_start;
+
+        /* o padrão tem até 3 bytes: recua 2 para pegar um fim cortado ao meio */
+        size_t from = p->pos >= p->line_start + 2 ? p->pos - 2 : p->line_start;
+        size_t end = scan->header_end(buf + from, len - from);
+        if (end == 0) {
+            p->pos = len;
+            return len >= HTTP_MAX_HEADER_BYTES ? HTTP_TOO_LARGE : HTTP_AGAIN;
+        }
+        req->header_len = from + end;
+        if (req->header_len > HTTP_MAX_HEADER_BYTES) return HTTP_TOO_LARGE;
+
+        /* linha de request */
+        size_t s = p->line_start;
+        const char* nl = memchr(buf + s, '\n', req->header_len - s);
+        size_t next = nl - buf + 1;
+        size_t e = nl - buf;
+        if (e > s && buf[e - 1] == '\r') e--;
+        int r = http_parse_request_line(req, buf, s, e);
+        if (r != HTTP_OK) return r;
+
+        /* headers, até a linha vazia */
+        for (s = next; ; s = next) {
+            nl = memchr(buf + s, '\n', req->header_len - s);
+            next = nl - buf + 1;
+            e = nl - buf;
+            if (e > s && buf[e - 1] == '\r') e--;
+            if (e == s) break;
+            r = http_parse_header_line(req, buf, s, e);
+            if (r != HTTP_OK) return r;
+        }
+        p->state = HP_BODY;
+        p->pos = p->line_start = req->header_len;
+    }
+
+    req->total_len = req->header_len + req->content_length;
+    if (req->total_len > HTTP_MAX_HEADER_BYTES) return HTTP_BAD; /* corpo não cabe no buffer */
+    if (len < req->total_len) return HTTP_AGAIN;
+    return HTTP_OK;
+}
+
+/* ------------------ Rotas e respostas pré-serializadas ------------------ */
+
+/* Cada rota tem a resposta inteira (status, headers e corpo) montada uma
+ * vez em routes_init(), num buffer contíguo com o tamanho guardado: no
+ * caminho do request não há strlen, snprintf nem Content-Length contado
+ * à mão. Há uma versão que fecha a conexão e uma keep-alive; as duas são
+ * HTTP/1.1 (a versão do servidor, que um cliente 1.0 também aceita) e só
+ * o Connection: muda. As entradas sem path são as respostas de erro. */
+static struct route routes[] = {
+    { "GET", "/", 200, "text/html",
+      "<html><head><title>MC833</title></head><body><h1>MC833</h1></body></html>", {{0}} },
+    { NULL, NULL, 400, "text/plain", "400 Bad Request\n", {{0}} },
+    { NULL, NULL, 404, "text/plain", "404 Not Found\n", {{0}} },
+    { NULL, NULL, 405, "text/plain", "405 Method Not Allowed\n", {{0}} },
+    { NULL, NULL, 431, "text/plain", "431 Request Header Fields Too Large\n", {{0}} },
+    { NULL, NULL, 502, "text/plain", "502 Bad Gateway\n", {{0}} },
+};
+static const int nroutes = sizeof(routes) / sizeof(routes[0]);
+
+static const char* status_reason(int status) {
+    switch (status) {
+    case 200: return "OK";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 431: return "Request Header Fields Too Large";
+    case 502: return "Bad Gateway";
+    default:  return "Unknown";
+    }
+}
+
+/* Data HTTP (RFC 9110, IMF-fixdate) tem sempre DATE_LEN bytes. Cada
+ * thread formata a sua uma vez por segundo; as respostas prontas guardam
+ * só o lugar dela (date_off) e a recebem por date_iov. */
+static __thread long date_next_ms;      /* now_ms() da próxima troca */
+static __thread char date_now[DATE_LEN + 1];
+
+static void format_http_date(char* out, time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, DATE_LEN + 1, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+/* serialize_response: monta status + headers + corpo em um buffer */
+static void serialize_response(struct static_response* r, const struct route* rt, int keepalive) {
+    size_t body_len = strlen(rt->body);
+    char head[256];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %d %s\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "Connection: %s\r\n",
+                     rt->status, status_reason(rt->status),
+                     rt->content_type, body_len, keepalive ? "keep-alive" : "close");
+    if (rt->status == 405) n += snprintf(head + n, sizeof(head) - n, "Allow: GET\r\n");
+
+    r->status = rt->status;
+    r->date_off = 0;
+    r->len = n + (config.date ? 6 + DATE_LEN + 2 : 0) + 2 + body_len;
+    r->buf = malloc(r->len + 1);
+    if (r->buf == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    char* p = r->buf;
+    memcpy(p, head, n);
+    p += n;
+    if (config.date) {
+        /* a data de agora só ocupa o lugar: a enviada vem de date_iov */
+        memcpy(p, "Date: ", 6);
+        r->date_off = (p + 6) - r->buf;
+        format_http_date(p + 6, time(NULL));
+        memcpy(p + 6 + DATE_LEN, "\r\n", 2);
+        p += 6 + DATE_LEN + 2;
+    }
+    memcpy(p, "\r\n", 2);
+    memcpy(p + 2, rt->body, body_len);
+    r->buf[r->len] = '\0';
+}
+
+/* routes_init: serializa todas as respostas (chamar antes de fork/threads) */
+void routes_init(void) {
+    for (int i = 0; i < nroutes; i++) {
+        serialize_response(&routes[i].resp[0], &routes[i], 0);
+        serialize_response(&routes[i].resp[1], &routes[i], 1);
+    }
+}
+
+/* date_tick: renova o date_now desta thread se o segundo mudou. É chamado
+ * uma vez por volta do laço de eventos (e por request nos modos que
+ * bloqueiam), antes de qualquer resposta da volta. Nada compartilhado é
+ * escrito: cada reactor tem a sua data. */
+void date_tick(long now) {
+    if (!config.date || now < date_next_ms) return;
+    date_next_ms = (now / 1000 + 1) * 1000;
+    format_http_date(date_now, time(NULL));
+}
+
+/* date_iov: o buffer pronto buf[0 .. len) em v[], com o Date: (em
+ * date_off; 0 = sem Date:) tirado de date e não do próprio buf. Buffers
+ * prontos são lidos por várias threads e conexões ao mesmo tempo e nunca
+ * mudam depois de montados; a data vai da cópia da conexão. Devolve
+ * quantos iovecs usou (1 ou 3). */
+static int date_iov(struct iovec* v, const char* buf, size_t len, size_t date_off, const char* date) {
+    if (date_off == 0) {
+        v[0] = (struct iovec){ (char*)buf, len };
+        return 1;
+    }
+    v[0] = (struct iovec){ (char*)buf, date_off };
+    v[1] = (struct iovec){ (char*)date, DATE_LEN };
+    v[2] = (struct iovec){ (char*)buf + date_off + DATE_LEN, len - date_off - DATE_LEN };
+    return 3;
+}
+
+static struct route* route_error(int status) {
+    for (int i = 0; i < nroutes; i++) {
+        if (routes[i].path == NULL && routes[i].status == status) return &routes[i];
+    }
+    return NULL;
+}
+
+/* route_find: rota para o resultado de http_parse (nunca NULL) */
+struct route* route_find(const char* base, const struct http_request* req, int result) {
+    if (result == HTTP_TOO_LARGE) return route_error(431);
+    if (result != HTTP_OK) return route_error(400);
+    int path_known = 0;
+    for (int i = 0; i < nroutes; i++) {
+        if (routes[i].path == NULL || !slice_eq(base, req->path, routes[i].path)) continue;
+        if (slice_eq(base, req->method, routes[i].method)) return &routes[i];
+        path_known = 1;
+    }
+    return route_error(path_known ? 405 : 404);
+}
+
+/* ------------------ Arquivos estáticos (root=DIR) ------------------ */
+
+/* Com root=DIR, GET /caminho serve DIR/caminho com sendfile(). Os arquivos
+ * abertos ficam num cache LRU (fd + fstat) por thread, então um arquivo
+ * quente não paga open()/stat() a cada request; o path é revalidado com
+ * fstatat() no máximo uma vez por segundo. Uma entrada em uso por alguma
+ * conexão (refs > 0) não é fechada: se sair do cache, fecha no último
+ * file_release(). Tudo é aberto por root_open, que não deixa um symlink
+ * levar para fora do root. */
+static int docroot_fd = -1;
+static __thread struct file_cache fcache;
+
+static const struct {
+    const char* ext;
+    const char* type;
+} content_types[] = {
+    { "html", "text/html" },
+    { "htm",  "text/html" },
+    { "css",  "text/css" },
+    { "js",   "application/javascript" },
+    { "json", "application/json" },
+    { "txt",  "text/plain" },
+    { "png",  "image/png" },
+    { "jpg",  "image/jpeg" },
+    { "jpeg", "image/jpeg" },
+    { "gif",  "image/gif" },
+    { "svg",  "image/svg+xml" },
+    { "ico",  "image/x-icon" },
+    { "pdf",  "application/pdf" },
+};
+
+static const char* content_type_of(const char* path) {
+    const char* dot = strrchr(path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL) return "application/octet-stream";
+    for (size_t i = 0; i < sizeof(content_types) / sizeof(content_types[0]); i++) {
+        if (strcasecmp(dot + 1, content_types[i].ext) == 0) return content_types[i].type;
+    }
+    return "application/octet-stream";
+}
+
+/* files_init: abre o document root (chamar antes de fork/threads) */
+void files_init(void) {
+    if (config.root == NULL) return;
+    docroot_fd = open(config.root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (docroot_fd < 0) {
+        perror("open => erro: não foi possível abrir o root");
+        exit(1);
+    }
+    log_msg(LOG_SERVER, "servindo arquivos de %s (cache de %d fds por thread)",
+            config.root, config.file_cache);
+}
+
+/* root_open: abre rel (relativo ao root, sem ".." nem segmento vazio) sem
+ * sair do root. openat2 com RESOLVE_BENEATH recusa symlink que leve para
+ * fora e aceita os que ficam dentro; num kernel sem openat2 (antes do 5.6)
+ * cada componente é aberto com O_NOFOLLOW, ou seja, nenhum symlink vale */
+static int root_open(const char* rel, int flags) {
+    static int no_openat2;     /* ENOSYS visto (qualquer thread) */
+    if (!__atomic_load_n(&no_openat2, __ATOMIC_RELAXED)) {
+        struct open_how how = { .flags = flags | O_CLOEXEC, .resolve = RESOLVE_BENEATH };
+        int fd = syscall(SYS_openat2, docroot_fd, rel, &how, sizeof(how));
+        if (fd >= 0 || errno != ENOSYS) return fd;
+        __atomic_store_n(&no_openat2, 1, __ATOMIC_RELAXED);
+    }
+    int dirfd = docroot_fd;
+    for (;;) {
+        const char* slash = strchr(rel, '/');
+        if (slash == NULL) break;
+        char name[FILE_PATH_MAX];
+        memcpy(name, rel, slash - rel);
+        name[slash - rel] = '\0';
+        int next = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (dirfd != docroot_fd) close(dirfd);
+        if (next < 0) return -1;
+        dirfd = next;
+        rel = slash + 1;
+    }
+    int fd = openat(dirfd, rel, flags | O_NOFOLLOW | O_CLOEXEC);
+    if (dirfd != docroot_fd) {
+        int saved = errno;
+        close(dirfd);
+        errno = saved;
+    }
+    return fd;
+}
+
+/* file_rel_path: converte o path do request em caminho relativo ao root;
+ * 0 = path inválido (query é ignorada; ".." e segmento vazio são recusados:
+ * "//etc/passwd" viraria o caminho absoluto "/etc/passwd", que o openat
+ * abre ignorando o fd do root) */
+static int file_rel_path(const char* base, struct http_slice s, char* out) {
+    const char* p = base + s.off;
+    size_t len = s.len;
+    const char* q = memchr(p, '?', len);
+    if (q) len = q - p;
+    if (len == 0 || p[0] != '/' || len >= FILE_PATH_MAX - sizeof("index.html")) return 0;
+
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\0') return 0;
+        if (p[i] == '/' && i + 1 < len && p[i + 1] == '/') return 0;
+        if (p[i] == '/' && i + 2 < len && p[i + 1] == '.' && p[i + 2] == '.'
+            && (i + 3 == len || p[i + 3] == '/'))
+            return 0;
+    }
+    /* sem a barra inicial; diretório vira o seu index.html */
+    memcpy(out, p + 1, len - 1);
+    out[len - 1] = '\0';
+    if (len == 1 || p[len - 1] == '/') strcat(out, "index.html");
+    return 1;
+}
+
+static unsigned file_hash(const char* s) {
+    unsigned h = 2166136261u;   /* FNV-1a */
+    while (*s) h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h % FILE_CACHE_BUCKETS;
+}
+
+static void file_lru_unlink(struct file_entry* f) {
+    if (f->lprev) f->lprev->lnext = f->lnext;
+    else fcache.head = f->lnext;
+    if (f->lnext) f->lnext->lprev = f->lprev;
+    else fcache.tail = f->lprev;
+    f->lprev = f->lnext = NULL;
+}
+
+static void file_lru_push(struct file_entry* f) {
+    f->lprev = NULL;
+    f->lnext = fcache.head;
+    if (fcache.head) fcache.head->lprev = f;
+    else fcache.tail = f;
+    fcache.head = f;
+}
+
+/* file_drop: tira f do cache; o fd fecha quando ninguém mais o usa */
+static void file_drop(struct file_entry* f) {
+    struct file_entry** pp = &fcache.buckets[file_hash(f->path)];
+    while (*pp != f) pp = &(*pp)->hnext;
+    *pp = f->hnext;
+    file_lru_unlink(f);
+    fcache.count--;
+    f->stale = 1;
+    if (f->refs == 0) {
+        close(f->fd);
+        free(f);
+    }
+}
+
+/* file_release: a conexão terminou de enviar f */
+void file_release(struct file_entry* f) {
+    if (--f->refs == 0 && f->stale) {
+        close(f->fd);
+        free(f);
+    }
+}
+
+/* file_lookup: arquivo para o path do request (com uma referência a mais,
+ * devolvida em file_release) ou NULL se não existe / não é regular */
+struct file_entry* file_lookup(const char* base, struct http_slice path) {
+    char rel[FILE_PATH_MAX];
+    if (docroot_fd < 0 || !file_rel_path(base, path, rel)) return NULL;
+
+    long now = now_ms();
+    struct file_entry* f;
+    for (f = fcache.buckets[file_hash(rel)]; f != NULL; f = f->hnext) {
+        if (strcmp(f->path, rel) == 0) break;
+    }
+    if (f != NULL && now - f->checked_ms >= 1000) {
+        /* o arquivo pode ter sido trocado ou apagado desde o open() */
+        struct stat st;
+        if (fstatat(docroot_fd, rel, &st, 0) < 0 || st.st_ino != f->st.st_ino
+            || st.st_dev != f->st.st_dev || st.st_size != f->st.st_size
+            || st.st_mtim.tv_sec != f->st.st_mtim.tv_sec
+            || st.st_mtim.tv_nsec != f->st.st_mtim.tv_nsec) {
+            file_drop(f);
+            f = NULL;
+        } else {
+            f->checked_ms = now;
+        }
+    }
+    if (f != NULL) {
+        file_lru_unlink(f);
+        file_lru_push(f);
+        f->refs++;
+        return f;
+    }
+
+    int fd = root_open(rel, O_RDONLY);
+    if (fd < 0) return NULL;
+    f = malloc(sizeof(*f));
+    if (f == NULL || fstat(fd, &f->st) < 0 || !S_ISREG(f->st.st_mode)) {
+        free(f);
+        close(fd);
+        return NULL;
+    }
+    strcpy(f->path, rel);
+    f->fd = fd;
+    f->content_type = content_type_of(rel);
+    f->checked_ms = now;
+    f->refs = 1;
+    f->stale = 0;
+    f->hnext = f->lprev = f->lnext = NULL;
+
+    /* abre espaço tirando do fim da LRU quem não está em uso */
+    struct file_entry* victim = fcache.tail;
+    while (fcache.count >= config.file_cache && victim != NULL) {
+        struct file_entry* prev = victim->lprev;
+        if (victim->refs == 0) file_drop(victim);
+        victim = prev;
+    }
+    if (fcache.count >= config.file_cache) {
+        f->stale = 1;   /* cache cheio (ou desligado): fecha depois do envio */
+        return f;
+    }
+    unsigned h = file_hash(rel);
+    f->hnext = fcache.buckets[h];
+    fcache.buckets[h] = f;
+    file_lru_push(f);
+    fcache.count++;
+    return f;
+}
+
+/* file_header: status + headers da resposta com o corpo de f */
+size_t file_header(char* out, size_t cap, const struct file_entry* f, int keepalive) {
+    int n = snprintf(out, cap,
+                     "HTTP/1.1 200 OK\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %lld\r\n"
+                     "Connection: %s\r\n",
+                     f->content_type,
+                     (long long)f->st.st_size, keepalive ? "keep-alive" : "close");
+    if (config.date) n += snprintf(out + n, cap - n, "Date: %s\r\n", date_now);
+    n += snprintf(out + n, cap - n, "\r\n");
+    return n;
+}
+
+/* ------------------ Content store em RAM (store_max=N) ------------------ */
+
+/* Com root=DIR e store_max=N, os arquivos de até N bytes do root são
+ * carregados na partida em uma única arena (mmap anônimo): para cada um,
+ * o corpo e as duas versões dos headers (close / keep-alive) já
+ * serializadas. Um perfect hash (hash-and-displace) leva do path à
+ * entrada, e a resposta sai em iovecs no writev do laço, sem
+ * open/stat/sendfile. A arena não muda depois de montada: o Date: vai em
+ * um iovec à parte com a data da conexão (date_iov), então threads e
+ * stores recarregados não precisam reescrever nada.
+ *
+ * SIGHUP recarrega: a primeira thread que acorda monta um store novo e o
+ * publica em store_current; cada laço passa a usá-lo na próxima volta.
+ * Um store só é liberado quando o global e todas as threads o largaram,
+ * e cada thread só larga o seu quando nenhuma conexão dela ainda tem
+ * iovecs apontando para a arena antiga. */
+static struct content_store* store_current;
+static unsigned store_gen;
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t store_reload = 0;
+static __thread struct store_ref* store_mine;
+
+/* arquivo encontrado na varredura do root */
+struct store_file {
+    char path[FILE_PATH_MAX];   /* com a barra inicial */
+    off_t size;
+};
+
+static void sig_store_reload(int signo) {
+    (void)signo;
+    store_reload = 1;
+}
+
+/* store_hash: FNV-1a com semente, seguido de uma mistura final para que
+ * sementes diferentes espalhem bem as mesmas chaves */
+static unsigned store_hash(const char* key, size_t len, unsigned seed) {
+    unsigned h = 2166136261u ^ (seed * 0x9e3779b1u);
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)key[i]) * 16777619u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+/* store_walk: junta em files os regulares de até store_max bytes */
+static void store_walk(int dirfd, const char* prefix, struct store_file** files, int* n, int* cap, int depth) {
+    DIR* dir = fdopendir(dirfd);
+    if (dir == NULL) {
+        close(dirfd);
+        return;
+    }
+    struct dirent* de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+        char path[FILE_PATH_MAX];
+        if (snprintf(path, sizeof(path), "%s/%s", prefix, de->d_name) >= (int)sizeof(path) - (int)sizeof("index.html"))
+            continue;
+        struct stat st;
+        if (fstatat(dirfd, de->d_name, &st, 0) < 0) continue;
+        if (S_ISDIR(st.st_mode) && depth < 16) {
+            /* pelo root, não por dirfd: um symlink não tira a varredura dele */
+            int sub = root_open(path + 1, O_RDONLY | O_DIRECTORY);
+            if (sub >= 0) store_walk(sub, path, files, n, cap, depth + 1);
+        } else if (S_ISREG(st.st_mode) && st.st_size <= config.store_max) {
+            if (*n == *cap) {
+                *cap = *cap ? *cap * 2 : 64;
+                struct store_file* grown = realloc(*files, *cap * sizeof(**files));
+                if (grown == NULL) break;
+                *files = grown;
+            }
+            strcpy((*files)[*n].path, path);
+            (*files)[*n].size = st.st_size;
+            (*n)++;
+        }
+    }
+    closedir(dir);
+}
+
+/* store_index: monta o perfect hash sobre s->entries; 0 = falhou */
+static int store_index(struct content_store* s) {
+    int n = s->nentries;
+    s->nseeds = n / 4 + 1;
+    s->nslots = n + n / 4 + 1;
+    s->seeds = calloc(s->nseeds, sizeof(unsigned));
+    s->slots = malloc(s->nslots * sizeof(int));
+    int* first = malloc(s->nseeds * sizeof(int));
+    int* next = malloc((n + 1) * sizeof(int));
+    int* size = calloc(s->nseeds, sizeof(int));
+    int* tried = malloc((n + 1) * sizeof(int));
+    int ok = s->seeds && s->slots && first && next && size && tried;
+
+    if (ok) {
+        for (int i = 0; i < s->nslots; i++) s->slots[i] = -1;
+        for (int b = 0; b < s->nseeds; b++) first[b] = -1;
+        int maxsize = 0;
+        for (int i = 0; i < n; i++) {
+            struct store_entry* e = &s->entries[i];
+            unsigned b = store_hash(e->path, e->path_len, 0) % s->nseeds;
+            next[i] = first[b];
+            first[b] = i;
+            if (++size[b] > maxsize) maxsize = size[b];
+        }
+        /* baldes maiores primeiro: acham semente enquanto a tabela está vazia */
+        for (int sz = maxsize; sz > 0 && ok; sz--) {
+            for (int b = 0; b < s->nseeds && ok; b++) {
+                if (size[b] != sz) continue;
+                unsigned seed;
+                for (seed = 1; seed < (1u << 20); seed++) {
+                    int k = 0, i;
+                    for (i = first[b]; i >= 0; i = next[i]) {
+                        struct store_entry* e = &s->entries[i];
+                        int slot = store_hash(e->path, e->path_len, seed) % s->nslots;
+                        int clash = s->slots[slot] >= 0;
+                        for (int j = 0; j < k && !clash; j++) clash = tried[j] == slot;
+                        if (clash) break;
+                        tried[k++] = slot;
+                    }
+                    if (i < 0) break;
+                }
+                if (seed == (1u << 20)) {
+                    ok = 0;
+                    break;
+                }
+                s->seeds[b] = seed;
+                int k = 0;
+                for (int i = first[b]; i >= 0; i = next[i]) s->slots[tried[k++]] = i;
+            }
+        }
+    }
+    free(first);
+    free(next);
+    free(size);
+    free(tried);
+    return ok;
+}
+
+static void store_free(struct content_store* s) {
+    if (s->arena) munmap(s->arena, s->arena_len);
+    free(s->entries);
+    free(s->seeds);
+    free(s->slots);
+    free(s);
+}
+
+/* store_build: carrega o root numa arena nova; NULL = erro */
+static struct content_store* store_build(void) {
+    struct store_file* files = NULL;
+    int n = 0, cap = 0;
+    int dirfd = openat(docroot_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) return NULL;
+    store_walk(dirfd, "", &files, &n, &cap, 0);
+
+    struct content_store* s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        free(files);
+        return NULL;
+    }
+    /* cada index.html ganha também a entrada do diretório ("/sub/") */
+    s->entries = calloc(2 * n + 1, sizeof(struct store_entry));
+    s->arena_len = 1;
+    for (int i = 0; i < n; i++) s->arena_len += 2 * FILE_PATH_MAX + 2 * FILE_HDR_MAX + files[i].size;
+    s->arena = mmap(NULL, s->arena_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (s->arena == MAP_FAILED) s->arena = NULL;
+    if (s->entries == NULL || s->arena == NULL) {
+        free(files);
+        store_free(s);
+        return NULL;
+    }
+
+    char* p = s->arena;
+    for (int i = 0; i < n; i++) {
+        int fd = root_open(files[i].path + 1, O_RDONLY);
+        if (fd < 0) continue;
+        /* o arquivo pode ter mudado desde a varredura: lê no máximo o que
+         * foi reservado e anuncia o que foi lido de fato */
+        size_t got = 0;
+        ssize_t r;
+        while (got < (size_t)files[i].size && (r = read(fd, p + got, files[i].size - got)) > 0) got += r;
+        close(fd);
+
+        struct store_entry* e = &s->entries[s->nentries++];
+        e->body.iov_base = p;
+        e->body.iov_len = got;
+        p += got;
+        const char* type = content_type_of(files[i].path);
+        for (int k = 0; k < 2; k++) {
+            int len = snprintf(p, FILE_HDR_MAX,
+                               "HTTP/1.1 200 OK\r\n"
+                               "Content-Type: %s\r\n"
+                               "Content-Length: %zu\r\n"
+                               "Connection: %s\r\n",
+                               type, got, k ? "keep-alive" : "close");
+            e->date_off[k] = 0;
+            if (config.date) {
+                /* só o lugar da data: a enviada vem de date_iov */
+                char date[DATE_LEN + 1];
+                format_http_date(date, time(NULL));
+                e->date_off[k] = len + 6;
+                len += snprintf(p + len, FILE_HDR_MAX - len, "Date: %s\r\n", date);
+            }
+            len += snprintf(p + len, FILE_HDR_MAX - len, "\r\n");
+            e->hdr[k].iov_base = p;
+            e->hdr[k].iov_len = len;
+            p += len;
+        }
+        e->path = p;
+        e->path_len = strlen(files[i].path);
+        memcpy(p, files[i].path, e->path_len + 1);
+        p += e->path_len + 1;
+
+        size_t dlen = e->path_len - (sizeof("index.html") - 1);
+        if (e->path_len >= sizeof("index.html") - 1 && strcmp(e->path + dlen, "index.html") == 0
+            && e->path[dlen - 1] == '/') {
+            struct store_entry* alias = &s->entries[s->nentries++];
+            *alias = *e;
+            alias->path_len = dlen;   /* "/sub/" é prefixo de "/sub/index.html" */
+        }
+    }
+    free(files);
+
+    if (!store_index(s)) {
+        store_free(s);
+        return NULL;
+    }
+    s->refs = 1;
+    return s;
+}
+
+static void store_put(struct content_store* s) {
+    if (s && __atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) == 0) store_free(s);
+}
+
+/* store_ref_put: uma conexão (ou a própria thread) largou r */
+void store_ref_put(struct store_ref* r) {
+    if (--r->users == 0) {
+        store_put(r->store);
+        free(r);
+    }
+}
+
+/* store_init: primeiro store (chamar antes de fork/threads) */
+void store_init(void) {
+    if (config.store_max <= 0 || docroot_fd < 0) return;
+    store_current = store_build();
+    if (store_current == NULL) {
+        fprintf(stderr, "[store] erro ao carregar %s\n", config.root);
+        exit(1);
+    }
+    store_current->gen = store_gen = 1;
+    log_msg(LOG_SERVER, "store em RAM: %d entradas, %zu bytes de arena",
+            store_current->nentries, store_current->arena_len);
+    Signal(SIGHUP, sig_store_reload);
+}
+
+/* store_sync: chamado a cada volta do laço; atende um SIGHUP pendente e
+ * troca o store desta thread se houver um mais novo. Devolve 1 se esta
+ * chamada recarregou o store. */
+int store_sync(void) {
+    int reloaded = 0;
+    if (store_current == NULL) return 0;
+    if (store_reload && __atomic_exchange_n(&store_reload, 0, __ATOMIC_ACQ_REL)) {
+        struct content_store* s = store_build();
+        if (s == NULL) {
+            echo_servidor("[store] recarga falhou, mantendo o store atual");
+        } else {
+            pthread_mutex_lock(&store_lock);
+            struct content_store* old = store_current;
+            s->gen = ++store_gen;
+            store_current = s;
+            pthread_mutex_unlock(&store_lock);
+            store_put(old);
+            log_msg(LOG_SERVER, "[store] recarregado: %d entradas (geração %u)", s->nentries, s->gen);
+            reloaded = 1;
+        }
+    }
+    if (store_mine != NULL && store_mine->store->gen == __atomic_load_n(&store_gen, __ATOMIC_ACQUIRE))
+        return reloaded;
+
+    struct store_ref* r = malloc(sizeof(*r));
+    if (r == NULL) return reloaded;
+    pthread_mutex_lock(&store_lock);
+    r->store = store_current;
+    __atomic_add_fetch(&r->store->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&store_lock);
+    r->users = 1;
+    if (store_mine) store_ref_put(store_mine);
+    store_mine = r;
+    return reloaded;
+}
+
+/* store_lookup: entrada do path do request no store desta thread */
+const struct store_entry* store_lookup(const char* base, struct http_slice path) {
+    if (store_mine == NULL) return NULL;
+    const struct content_store* s = store_mine->store;
+    const char* key = base + path.off;
+    size_t len = path.len;
+    const char* q = memchr(key, '?', len);
+    if (q) len = q - key;
+
+    unsigned seed = s->seeds[store_hash(key, len, 0) % s->nseeds];
+    int i = s->slots[store_hash(key, len, seed) % s->nslots];
+    if (i < 0) return NULL;
+    const struct store_entry* e = &s->entries[i];
+    if (e->path_len != len || memcmp(e->path, key, len) != 0) return NULL;
+    return e;
+}
+
+/* simulate_delay: dorme sleep_time segundos (simula processamento lento) */
+void simulate_delay(int sleep_time) {
+    if (sleep_time > 0) {
+        struct timespec ts;
+        ts.tv_sec = sleep_time;
+        ts.tv_nsec = 0;
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* socket_timeout: SO_RCVTIMEO/SO_SNDTIMEO de sec segundos (0 = sem prazo) */
+static void socket_timeout(int fd, int opt, int sec) {
+    if (sec <= 0) return;
+    struct timeval tv = { .tv_sec = sec, .tv_usec = 0 };
+    if (setsockopt(fd, SOL_SOCKET, opt, &tv, sizeof(tv)) < 0) perror("setsockopt timeout");
+}
+
+/* socket_abort: o close seguinte descarta o buffer de envio e manda RST,
+ * em vez de o kernel seguir insistindo com um leitor parado */
+static void socket_abort(int fd) {
+    struct linger lg = { .l_onoff = 1, .l_linger = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+}
+
+/* process_request: responde os requests de connfd até o keep-alive
+ * acabar. Aqui não há laço de eventos: cada request é lido até o parser
+ * fechar (pode vir em vários segmentos) com um poll limitado pelo prazo da
+ * vez, como em conn_wait_read: keepalive_timeout esperando o próximo
+ * request de uma conexão keep-alive, header_timeout contado do primeiro
+ * byte (ou da conexão) enquanto ele chega. Requests que vieram juntos
+ * (pipeline) ficam em request[] e são respondidos em ordem, sem novo read.
+ * write_timeout vira prazo do próprio socket bloqueante. Cada request
+ * dorme sleep_time segundos antes da resposta. */
+void process_request(int connfd, int sleep_time) {
+    socket_timeout(connfd, SO_SNDTIMEO, config.write_timeout);
+
+    char request[MAXLINE + 1];
+    struct http_parser parser;
+    size_t len = 0;             /* bytes em request[] (o request corrente e os seguintes) */
+    unsigned served = 0;
+    for (;;) {
+        http_parser_init(&parser);
+        int result = len > 0 ? http_parse(&parser, request, len) : HTTP_AGAIN;
+        ssize_t n = 1;
+        int timed_out = 0;
+        int idle = len == 0 && served > 0;
+        int timeout = idle ? config.keepalive_timeout : config.header_timeout;
+        long deadline = timeout > 0 ? now_ms() + timeout * 1000L : -1;
+        while (result == HTTP_AGAIN && len < MAXLINE) {
+            if (deadline >= 0) {
+                struct pollfd pfd = { .fd = connfd, .events = POLLIN };
+                long left = deadline - now_ms();
+                if (left <= 0 || poll(&pfd, 1, (int)left) == 0) {
+                    timed_out = 1;
+                    break;
+                }
+            }
+            n = read(connfd, request + len, MAXLINE - len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            len += n;
+            METRIC_ADD(bytes_in, n);
+            if (idle) {
+                /* o próximo request começou: agora vale o header_timeout */
+                idle = 0;
+                deadline = config.header_timeout > 0 ? now_ms() + config.header_timeout * 1000L : -1;
+            }
+            result = http_parse(&parser, request, len);
+        }
+        if (len == 0 || (result == HTTP_AGAIN && n < 0)) {
+            /* cliente fechou entre requests, keep-alive ocioso ou erro */
+            if (timed_out && served == 0)
+                log_msg(LOG_CONN, "pid=%d connfd=%d: prazo de request vencido, fechando", (int)getpid(), connfd);
+            else if (n < 0) {
+                perror("read");
+                METRIC_ADD(errors, 1);
+            }
+            return;
+        }
+        if (timed_out) {
+            log_msg(LOG_CONN, "pid=%d connfd=%d: prazo de request vencido, fechando", (int)getpid(), connfd);
+            return;
+        }
+        /* cliente fechou a escrita no meio de um request: 400 */
+        if (result == HTTP_AGAIN) result = HTTP_BAD;
+        simulate_delay(sleep_time);
+        long started = metrics_table ? now_us() : 0;
+        size_t req_len = result == HTTP_OK ? parser.req.total_len : len;
+        char saved = request[req_len];
+        request[req_len] = '\0';
+        log_request(request, req_len);
+        request[req_len] = saved;
+        METRIC_ADD(requests, 1);
+
+        /* como em conn_queue_response: erro e o último request permitido
+         * encerram a conexão */
+        served++;
+        int keepalive = result == HTTP_OK && parser.req.keepalive && served < (unsigned)config.keepalive_max;
+        store_sync();
+        date_tick(now_ms());
+        char date[DATE_LEN];
+        memcpy(date, date_now, DATE_LEN);
+        const struct store_entry* e = NULL;
+        struct file_entry* f = NULL;
+        char* dyn = NULL;
+        size_t dyn_len = 0;
+        if (result == HTTP_OK && metrics_match(request, &parser.req))
+            dyn = metrics_response(keepalive, &dyn_len);
+        else if (result == HTTP_OK && slice_eq(request, parser.req.method, "GET")
+                 && (e = store_lookup(request, parser.req.path)) == NULL)
+            f = file_lookup(request, parser.req.path);
+
+        ssize_t sent;
+        if (dyn != NULL) {
+            sent = Write(dyn, dyn_len, connfd);
+            free(dyn);
+        } else if (e != NULL) {
+            struct iovec iov[4];
+            int cnt = date_iov(iov, e->hdr[keepalive].iov_base, e->hdr[keepalive].iov_len,
+                               e->date_off[keepalive], date);
+            if (e->body.iov_len > 0) iov[cnt++] = e->body;
+            sent = Writev(connfd, iov, cnt);
+        } else if (f != NULL) {
+            char hdr[FILE_HDR_MAX];
+            off_t off = 0;
+            sent = Write(hdr, file_header(hdr, sizeof(hdr), f, keepalive), connfd);
+            if (sent >= 0) {
+                while (off < f->st.st_size && sendfile(connfd, f->fd, &off, f->st.st_size - off) > 0)
+                    ;
+                if (off < f->st.st_size) {
+                    socket_abort(connfd);   /* write_timeout */
+                    keepalive = 0;
+                }
+                sent += off;
+            }
+            file_release(f);
+        } else {
+            struct route* rt = route_find(request, &parser.req, result);
+            if (rt->status >= 400 && rt->status < 500) METRIC_ADD(resp_4xx, 1);
+            const struct static_response* resp = &rt->resp[keepalive];
+            struct iovec iov[3];
+            sent = Writev(connfd, iov, date_iov(iov, resp->buf, resp->len, resp->date_off, date));
+        }
+        if (sent == -1) {
+            perror("write => erro: não foi possível enviar a mensagem ao cliente");
+            METRIC_ADD(errors, 1);
+            return;
+        }
+        METRIC_ADD(bytes_out, sent);
+        if (metrics_table) metrics_latency(now_us() - started, 1);
+        if (!keepalive) return;
+
+        /* o que veio depois deste request é o começo do próximo */
+        len -= req_len;
+        memmove(request, request + req_len, len);
+    }
+}
+
+/* Listen wrapper */
+void Listen(int listenfd, int tamanho_fila) {
+  if (listen(listenfd, tamanho_fila) == -1) {
+      perror("listen => erro: não foi possível ativar o listening socket");
+      close(listenfd);
+      exit(1);
+  }
+}
+
+/* log_server_info: grava server.info com IP e PORT */
+void log_server_info(int listenfd) {
+  struct sockaddr_in bound; socklen_t blen = sizeof(bound);
+  if (getsockname(listenfd, (struct sockaddr*)&bound, &blen) == 0) {
+      unsigned short p = ntohs(bound.sin_port);
+      printf("[SERVIDOR] Escutando em 0.0.0.0:%u\n", p);
+      FILE *f = fopen("server.info", "w");
+      if (f) { fprintf(f, "IP=127.0.0.1\nPORT=%u\n", p); fclose(f); }
+      fflush(stdout);
+  }
+}
+
+/* ------------------ Pools de conexões e buffers (slab) ------------------ */
+
+/* struct conn e buffers de leitura vêm de pools de objetos de tamanho fixo,
+ * um por thread: cada laço só libera o que ele mesmo alocou, então não há
+ * trava. O pool cresce de SLAB_BYTES em SLAB_BYTES com mmap e não devolve
+ * memória ao sistema; alocar e liberar é tirar e pôr na lista livre, sem
+ * malloc no caminho quente. O consumo fica em pico de conexões x
+ * sizeof(struct conn) mais pico de requests em andamento x MAXLINE: o
+ * buffer de leitura volta ao pool sempre que a conexão fica esperando
+ * request sem nada pela metade (ver conn_wait_read), então conexões novas e
+ * keep-alive ociosas ocupam só a struct conn. */
+
+#define SLAB_BYTES  (256 * 1024)
+#define SLAB_ALIGN  64          /* linha de cache; o modo 6 usa os bits baixos */
+
+struct slab_pool {
+    size_t size;            /* tamanho de cada objeto (múltiplo de SLAB_ALIGN) */
+    void* free;             /* lista livre, encadeada no próprio objeto */
+    size_t slabs;           /* slabs obtidos com mmap */
+    size_t used;            /* objetos emprestados agora */
+};
+
+#define SLAB_POOL(bytes) { .size = ((bytes) + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1) }
+
+static __thread struct slab_pool conn_pool = SLAB_POOL(sizeof(struct conn));
+static __thread struct slab_pool in_pool = SLAB_POOL(MAXLINE);
+
+/* slab_get: um objeto do pool (NULL se o mmap falhar) */
+static void* slab_get(struct slab_pool* p) {
+    if (p->free == NULL) {
+        char* slab = mmap(NULL, SLAB_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (slab == MAP_FAILED) {
+            perror("mmap slab");
+            return NULL;
+        }
+        /* empilha de trás para frente: os primeiros objetos saem primeiro */
+        for (size_t i = SLAB_BYTES / p->size; i-- > 0;) {
+            void** o = (void**)(slab + i * p->size);
+            *o = p->free;
+            p->free = o;
+        }
+        p->slabs++;
+    }
+    void** o = p->free;
+    p->free = *o;
+    p->used++;
+    return o;
+}
+
+/* slab_put: devolve o ao pool (NULL é ignorado) */
+static void slab_put(struct slab_pool* p, void* o) {
+    if (o == NULL) return;
+    *(void**)o = p->free;
+    p->free = o;
+    p->used--;
+}
+
+/* ------------------ Tabela de conexões e limite de fds ------------------ */
+
+/* fd_limit_init: sobe o limite de fds abertos (RLIMIT_NOFILE) até o teto
+ * permitido ao processo e ajusta max_conns a ele, descontando FD_RESERVE e
+ * o cache de arquivos de cada uma das threads que servem conexões */
+void fd_limit_init(int threads) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        perror("getrlimit");
+        return;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        struct rlimit want = rl;
+        want.rlim_cur = rl.rlim_max == RLIM_INFINITY ? 1 << 20 : rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &want) == 0) rl = want;
+        else perror("setrlimit RLIMIT_NOFILE");
+    }
+    long avail = (long)rl.rlim_cur - FD_RESERVE - (long)config.file_cache * threads;
+    if (avail < 1) avail = 1;
+    if (config.max_conns <= 0) {
+        config.max_conns = (int)avail;
+    } else if (config.max_conns > avail) {
+        log_msg(LOG_SERVER, "max_conns=%d não cabe em RLIMIT_NOFILE=%ld, usando %ld",
+                config.max_conns, (long)rl.rlim_cur, avail);
+        config.max_conns = (int)avail;
+    }
+    log_msg(LOG_SERVER, "RLIMIT_NOFILE=%ld max_conns=%d", (long)rl.rlim_cur, config.max_conns);
+}
+
+void conn_table_init(struct conn_table* t, int max) {
+    memset(t, 0, sizeof(*t));
+    t->max = max > 0 ? max : 1;
+}
+
+/* conn_table_add: registra c em by_fd[c->fd] (-1 = sem memória) */
+static int conn_table_add(struct conn_table* t, struct conn* c) {
+    if (c->fd >= t->cap) {
+        int cap = t->cap ? t->cap : 64;
+        while (cap <= c->fd) cap *= 2;
+        struct conn** by_fd = realloc(t->by_fd, cap * sizeof(*by_fd));
+        if (by_fd == NULL) return -1;
+        memset(by_fd + t->cap, 0, (cap - t->cap) * sizeof(*by_fd));
+        t->by_fd = by_fd;
+        t->cap = cap;
+    }
+    t->by_fd[c->fd] = c;
+    t->count++;
+    c->table = t;
+    return 0;
+}
+
+/* conn_table_del: tira c da tabela. O kernel reaproveita o número do fd no
+ * próximo accept e no modo 6 o CQE desse accept pode ser tratado antes do
+ * CQE do close, então a posição só é limpa se ainda for de c */
+static void conn_table_del(struct conn* c) {
+    struct conn_table* t = c->table;
+    if (t == NULL) return;
+    if (t->by_fd[c->fd] == c) t->by_fd[c->fd] = NULL;
+    t->count--;
+    t->starved = 0;
+    c->table = NULL;
+}
+
+/* conn_table_accepting: 0 com a tabela cheia (ou sem fds), quando o laço
+ * deixa de aceitar e as conexões novas esperam na fila do listen em vez de
+ * serem aceitas e fechadas; registra as transições no log */
+int conn_table_accepting(struct conn_table* t, const char* tag) {
+    int full = t->count >= t->max || t->starved;
+    if (full != t->paused) {
+        t->paused = full;
+        log_msg(LOG_SERVER, "%s pid=%d %s accept (%d conexões, max_conns=%d%s)", tag, (int)getpid(),
+                full ? "pausando" : "retomando", t->count, t->max, t->starved ? ", sem fds" : "");
+    }
+    return !full;
+}
+
+/* accept_starved: accept falhou por falta de fds. Com conexões abertas, o
+ * laço pausa até uma delas fechar; sem nenhuma não há o que esperar */
+static void accept_starved(struct conn_table* t) {
+    if (t->count > 0) t->starved = 1;
+    else perror("accept");
+}
+
+/* ------------------ TLS (tls=1, OpenSSL) ------------------ */
+
+/* Com tls=1 cada conexão dos modos 1 a 5 ganha um SSL sobre o próprio fd
+ * non-blocking. O handshake roda em READING_HEADERS, sob o header_timeout
+ * como um request lento, e as leituras passam por SSL_read. No fim do
+ * handshake o OpenSSL tenta entregar as chaves ao kernel (kTLS,
+ * SSL_OP_ENABLE_KTLS): com o envio no kernel, writev e sendfile seguem
+ * iguais ao caminho sem TLS e o kernel cifra os registros. Sem kTLS o envio
+ * vai por SSL_write, juntando out[] (ou um trecho do arquivo lido com
+ * pread) no buffer da thread; depois de um SSL_write que não terminou, a
+ * próxima chamada remonta exatamente os mesmos bytes, como o OpenSSL exige.
+ *
+ * Quando o OpenSSL precisa escrever para conseguir ler (ou o contrário),
+ * tls_flip fica ligado e select/poll esperam o outro evento; o epoll já
+ * avisa dos dois. O SSL_CTX nasce antes de fork/threads, então a chave dos
+ * session tickets vale para o servidor inteiro e o cliente retoma a sessão
+ * em qualquer reactor ou filho. */
+
+#ifdef HAVE_OPENSSL
+
+static SSL_CTX* tls_ctx;
+static __thread char tls_buf[TLS_CHUNK];
+
+/* tls_self_signed: chave P-256 e certificado autoassinado para localhost */
+static int tls_self_signed(SSL_CTX* ctx) {
+    EVP_PKEY* key = EVP_EC_gen("P-256");
+    X509* cert = X509_new();
+    int ok = 0;
+    if (key != NULL && cert != NULL) {
+        X509_set_version(cert, 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert), (long)time(NULL));
+        X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+        X509_gmtime_adj(X509_getm_notAfter(cert), 365L * 24 * 3600);
+        X509_set_pubkey(cert, key);
+        X509_NAME* name = X509_get_subject_name(cert);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)"localhost", -1, -1, 0);
+        X509_set_issuer_name(cert, name);
+        ok = X509_sign(cert, key, EVP_sha256()) > 0 && SSL_CTX_use_certificate(ctx, cert) == 1
+             && SSL_CTX_use_PrivateKey(ctx, key) == 1;
+    }
+    X509_free(cert);
+    EVP_PKEY_free(key);
+    return ok;
+}
+
+/* tls_init: SSL_CTX do servidor (chamar antes de fork/threads) */
+void tls_init(void) {
+    if (!config.tls) return;
+    tls_ctx = SSL_CTX_new(TLS_server_method());
+    if (tls_ctx == NULL) {
+        ERR_print_errors_fp(stderr);
+        exit(1);
+    }
+    SSL_CTX_set_min_proto_version(tls_ctx, TLS1_2_VERSION);
+    SSL_CTX_set_options(tls_ctx, SSL_OP_NO_RENEGOTIATION | (config.ktls ? SSL_OP_ENABLE_KTLS : 0));
+    SSL_CTX_set_mode(tls_ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    /* retomada: tickets (TLS 1.3 e 1.2) com a chave gerada aqui; o cache
+     * de sessões do servidor fica para clientes TLS 1.2 sem ticket */
+    SSL_CTX_set_session_cache_mode(tls_ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_set_session_id_context(tls_ctx, (const unsigned char*)"server_http", 11);
+    SSL_CTX_set_num_tickets(tls_ctx, config.tls_tickets);
+    if (config.tls_tickets == 0) SSL_CTX_set_options(tls_ctx, SSL_OP_NO_TICKET);
+
+    int ok;
+    if (config.tls_cert != NULL) {
+        ok = SSL_CTX_use_certificate_chain_file(tls_ctx, config.tls_cert) == 1
+             && SSL_CTX_use_PrivateKey_file(tls_ctx, config.tls_key ? config.tls_key : config.tls_cert,
+                                            SSL_FILETYPE_PEM) == 1
+             && SSL_CTX_check_private_key(tls_ctx) == 1;
+    } else {
+        ok = tls_self_signed(tls_ctx);
+    }
+    if (!ok) {
+        fprintf(stderr, "[tls] erro no certificado/chave\n");
+        ERR_print_errors_fp(stderr);
+        exit(1);
+    }
+    log_msg(LOG_SERVER, "TLS: certificado %s, %d ticket(s) por handshake, kTLS %s",
+            config.tls_cert ? config.tls_cert : "autoassinado (localhost)", config.tls_tickets,
+            config.ktls ? "quando o kernel suportar" : "desligado");
+}
+
+static int tls_enabled(void) {
+    return tls_ctx != NULL;
+}
+
+/* tls_attach: SSL para a conexão nova (-1 = sem memória) */
+static int tls_attach(struct conn* c) {
+    c->ssl = SSL_new(tls_ctx);
+    if (c->ssl == NULL || SSL_set_fd(c->ssl, c->fd) != 1) {
+        SSL_free(c->ssl);
+        c->ssl = NULL;
+        ERR_clear_error();
+        return -1;
+    }
+    SSL_set_accept_state(c->ssl);
+    return 0;
+}
+
+/* tls_free: close_notify (sem esperar a do cliente) e libera o SSL */
+static void tls_free(struct conn* c) {
+    if (c->ssl == NULL) return;
+    if (!c->tls_failed && SSL_is_init_finished(c->ssl)) SSL_shutdown(c->ssl);
+    SSL_free(c->ssl);
+    c->ssl = NULL;
+    ERR_clear_error();
+}
+
+/* tls_result: traduz a falha de uma chamada SSL_* para o contrato de
+ * read/write (-1 com errno; 0 = cliente encerrou) */
+static ssize_t tls_result(struct conn* c, int r, int reading) {
+    int err = SSL_get_error(c->ssl, r);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+        c->tls_flip = reading ? (err == SSL_ERROR_WANT_WRITE) : (err == SSL_ERROR_WANT_READ);
+        errno = EAGAIN;
+        return -1;
+    }
+    c->tls_failed = 1;
+    if (err == SSL_ERROR_ZERO_RETURN || (err == SSL_ERROR_SYSCALL && errno == 0)) {
+        ERR_clear_error();
+        return 0;
+    }
+    if (err == SSL_ERROR_SSL) {
+        if (log_on(LOG_CONN)) {
+            char msg[256];
+            ERR_error_string_n(ERR_peek_last_error(), msg, sizeof(msg));
+            log_text("[tls] connfd=%d %s", c->fd, msg);
+        }
+        errno = EPROTO;
+    }
+    ERR_clear_error();
+    return -1;
+}
+
+/* tls_ready: handshake terminou */
+static void tls_ready(struct conn* c) {
+    int resumed = SSL_session_reused(c->ssl);
+    c->tls_kernel = BIO_get_ktls_send(SSL_get_wbio(c->ssl));
+    METRIC_ADD(tls_handshakes, 1);
+    if (resumed) METRIC_ADD(tls_resumed, 1);
+    if (c->tls_kernel) METRIC_ADD(tls_kernel, 1);
+    log_msg(LOG_CONN, "[tls] connfd=%d %s %s%s, kTLS envio %s, recepção %s", c->fd,
+            SSL_get_version(c->ssl), SSL_get_cipher_name(c->ssl), resumed ? " (retomada)" : "",
+            c->tls_kernel ? "sim" : "não", BIO_get_ktls_recv(SSL_get_rbio(c->ssl)) ? "sim" : "não");
+}
+
+static ssize_t tls_recv(struct conn* c, void* buf, size_t len) {
+    c->tls_flip = 0;
+    if (!SSL_is_init_finished(c->ssl)) {
+        int r = SSL_do_handshake(c->ssl);
+        if (r != 1) return tls_result(c, r, 1);
+        tls_ready(c);
+    }
+    int r = SSL_read(c->ssl, buf, len > INT_MAX ? INT_MAX : (int)len);
+    return r > 0 ? r : tls_result(c, r, 1);
+}
+
+static ssize_t tls_writev(struct conn* c, const struct iovec* iov, int cnt) {
+    size_t n = 0;
+    for (int i = 0; i < cnt && n < sizeof(tls_buf); i++) {
+        size_t k = iov[i].iov_len < sizeof(tls_buf) - n ? iov[i].iov_len : sizeof(tls_buf) - n;
+        memcpy(tls_buf + n, iov[i].iov_base, k);
+        n += k;
+    }
+    c->tls_flip = 0;
+    int r = SSL_write(c->ssl, tls_buf, (int)n);
+    return r > 0 ? r : tls_result(c, r, 0);
+}
+
+static ssize_t tls_sendfile(struct conn* c) {
+    size_t want = c->file_left < sizeof(tls_buf) ? c->file_left : sizeof(tls_buf);
+    ssize_t got = pread(c->file->fd, tls_buf, want, c->file_off);
+    if (got <= 0) return got;
+    c->tls_flip = 0;
+    int r = SSL_write(c->ssl, tls_buf, (int)got);
+    if (r <= 0) return tls_result(c, r, 0);
+    c->file_off += r;
+    return r;
+}
+
+#else
+
+void tls_init(void) {
+    if (!config.tls) return;
+    fprintf(stderr, "tls=1: compilado sem OpenSSL (use -DHAVE_OPENSSL ... -lssl -lcrypto)\n");
+    exit(1);
+}
+
+static int tls_enabled(void) { return 0; }
+static int tls_attach(struct conn* c) { (void)c; return -1; }
+static void tls_free(struct conn* c) { (void)c; }
+static ssize_t tls_recv(struct conn* c, void* buf, size_t len) { (void)c; (void)buf; (void)len; return -1; }
+static ssize_t tls_writev(struct conn* c, const struct iovec* iov, int cnt) { (void)c; (void)iov; (void)cnt; return -1; }
+static ssize_t tls_sendfile(struct conn* c) { (void)c; return -1; }
+
+#endif /* HAVE_OPENSSL */
+
+/* conn_recv/conn_writev/conn_sendfile: E/S da conexão, com ou sem TLS, no
+ * contrato de read/writev/sendfile (conn_sendfile avança file_off) */
+static ssize_t conn_recv(struct conn* c, void* buf, size_t len) {
+    if (c->ssl == NULL) return read(c->fd, buf, len);
+    return len > 0 ? tls_recv(c, buf, len) : 0;
+}
+
+static ssize_t conn_writev(struct conn* c, const struct iovec* iov, int cnt) {
+    if (c->ssl == NULL || c->tls_kernel) return writev(c->fd, iov, cnt);
+    return tls_writev(c, iov, cnt);
+}
+
+static ssize_t conn_sendfile(struct conn* c) {
+    if (c->ssl == NULL || c->tls_kernel) return sendfile(c->fd, c->file->fd, &c->file_off, c->file_left);
+    return tls_sendfile(c);
+}
+
+/* ------------------ Proxy reverso (upstream=HOST:PORTA) ------------------ */
+
+/* Com upstream=, os requests cujo path começa por proxy= (padrão "/") são
+ * repassados a outro servidor HTTP, p.ex. outra instância deste em
+ * loopback. Cada thread guarda até proxy_pool conexões keep-alive ociosas
+ * com o upstream e tira uma delas (ou abre outra, non-blocking) quando um
+ * request chega. O socket do upstream entra no epoll do reactor com o bit
+ * PROXY_TAG em data.ptr, e os eventos dele só avançam a conexão do cliente
+ * (proxy_relay, chamado do conn_on_writable).
+ *
+ * O request segue em HTTP/1.1 e keep-alive, sem os headers de salto a
+ * salto do cliente (proxy_request). A resposta é lida até o fim dos headers em
+ * resp[] e segue para o cliente por out[], com o Connection: trocado pelo
+ * desta conexão e o começo do corpo que veio no mesmo read; o resto do
+ * corpo passa por splice() do socket do upstream para o pipe da conexão e
+ * do pipe para o cliente, sem cópia em espaço de usuário. Com TLS sem kTLS (ou proxy_splice=0) o corpo é lido em
+ * resp[] e enviado por out[]. Um corpo chunked passa por uma máquina de
+ * estados (proxy_chunks) que acha o chunk 0 e o fim do trailer: só os dados
+ * dos chunks vão por splice, o enquadramento é lido em resp[], e para um
+ * cliente HTTP/1.0 ele não é repassado (o corpo termina com o fechamento).
+ * Uma resposta com Content-Length ou chunked (e sem Connection: close)
+ * devolve a conexão ao pool; sem nenhum dos dois o corpo vai até o
+ * upstream fechar e o cliente também é fechado no fim. Uma conexão do pool
+ * que o upstream fechou enquanto estava ociosa é trocada por uma nova, uma
+ * vez, se falhar antes do primeiro byte da resposta; as outras falhas antes
+ * dos headers viram 502 para o cliente. */
+
+#define PROXY_TAG   1UL         /* bit baixo de data.ptr: evento de upstream */
+#define PROXY_CHUNK 65536       /* bytes por splice (capacidade padrão do pipe) */
+
+static struct sockaddr_storage proxy_addr;
+static socklen_t proxy_addr_len;
+static size_t proxy_prefix_len;
+static __thread int proxy_epfd = -1;            /* epoll do reactor da thread */
+static __thread struct upstream* proxy_idle;    /* pool (LIFO) */
+static __thread int proxy_nidle;
+static __thread struct upstream* proxy_dead;    /* fechadas, liberadas em proxy_reap */
+
+/* proxy_init: resolve upstream= (chamar antes de fork/threads) */
+void proxy_init(void) {
+    if (config.upstream == NULL) return;
+    if (config.proxy == NULL) config.proxy = "/";
+    proxy_prefix_len = strlen(config.proxy);
+
+    char host[256];
+    const char* colon = strrchr(config.upstream, ':');
+    if (colon == NULL || colon == config.upstream || (size_t)(colon - config.upstream) >= sizeof(host)) {
+        fprintf(stderr, "upstream=%s: esperado HOST:PORTA\n", config.upstream);
+        exit(1);
+    }
+    memcpy(host, config.upstream, colon - config.upstream);
+    host[colon - config.upstream] = '\0';
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host, colon + 1, &hints, &ai);
+    if (err != 0) {
+        fprintf(stderr, "upstream=%s: %s\n", config.upstream, gai_strerror(err));
+        exit(1);
+    }
+    memcpy(&proxy_addr, ai->ai_addr, ai->ai_addrlen);
+    proxy_addr_len = ai->ai_addrlen;
+    freeaddrinfo(ai);
+    log_msg(LOG_SERVER, "proxy: %s* -> %s (pool de %d por thread, corpo por %s)", config.proxy,
+            config.upstream, config.proxy_pool, config.proxy_splice ? "splice" : "cópia");
+}
+
+/* proxy_match: o request vai para o upstream? O prefixo casa por
+ * segmento inteiro: proxy=/api pega /api, /api/x e /api?q, mas não /apix
+ * (a não ser que o próprio prefixo termine em '/') */
+static int proxy_match(const char* base, const struct http_request* req) {
+    if (config.upstream == NULL || req->path.len < proxy_prefix_len
+        || memcmp(base + req->path.off, config.proxy, proxy_prefix_len) != 0)
+        return 0;
+    if (req->path.len == proxy_prefix_len || proxy_prefix_len == 0 || config.proxy[proxy_prefix_len - 1] == '/')
+        return 1;
+    char next = base[req->path.off + proxy_prefix_len];
+    return next == '/' || next == '?';
+}
+
+/* proxy_connect: abre up->fd (connect non-blocking) e registra no epoll */
+static int proxy_connect(struct upstream* up) {
+    up->fd = socket(proxy_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (up->fd < 0) return -1;
+    METRIC_ADD(upstream_connects, 1);
+    if (connect(up->fd, (struct sockaddr*)&proxy_addr, proxy_addr_len) < 0 && errno != EINPROGRESS)
+        return -1;
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = (char*)up + PROXY_TAG;
+    return epoll_ctl(proxy_epfd, EPOLL_CTL_ADD, up->fd, &ev);
+}
+
+/* proxy_close: fecha up; a memória fica até proxy_reap, porque ainda pode
+ * haver evento dela no lote corrente do epoll */
+static void proxy_close(struct upstream* up) {
+    if (up->fd >= 0) close(up->fd);   /* close() tira o fd do epoll */
+    if (up->pipe[0] >= 0) {
+        close(up->pipe[0]);
+        close(up->pipe[1]);
+    }
+    up->fd = up->pipe[0] = up->pipe[1] = -1;
+    up->client = NULL;
+    up->next = proxy_dead;
+    proxy_dead = up;
+}
+
+/* proxy_reap: libera as conexões fechadas (fim de cada volta do laço) */
+void proxy_reap(void) {
+    while (proxy_dead) {
+        struct upstream* up = proxy_dead;
+        proxy_dead = up->next;
+        free(up);
+    }
+}
+
+/* proxy_get: conexão do pool ou uma nova (NULL = falhou) */
+static struct upstream* proxy_get(void) {
+    struct upstream* up = proxy_idle;
+    if (up != NULL) {
+        proxy_idle = up->next;
+        proxy_nidle--;
+        up->reused = 1;
+        return up;
+    }
+    if ((up = malloc(sizeof(*up))) == NULL) return NULL;
+    up->pipe[0] = up->pipe[1] = -1;
+    up->reused = 0;
+    if (proxy_connect(up) < 0
+        || (config.proxy_splice && pipe2(up->pipe, O_NONBLOCK | O_CLOEXEC) < 0)) {
+        log_msg(LOG_CONN, "proxy: upstream %s: %s", config.upstream, strerror(errno));
+        proxy_close(up);
+        return NULL;
+    }
+    return up;
+}
+
+/* proxy_put: devolve up ao pool (keep) ou fecha */
+static void proxy_put(struct upstream* up, int keep) {
+    if (!keep || proxy_nidle >= config.proxy_pool) {
+        proxy_close(up);
+        return;
+    }
+    up->client = NULL;
+    up->next = proxy_idle;
+    proxy_idle = up;
+    proxy_nidle++;
+}
+
+/* headers de salto a salto (RFC 9110, 7.6.1): valem só entre o cliente e
+ * este servidor e não seguem para o upstream */
+static const char* const proxy_hop[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade",
+};
+
+/* proxy_listed: name[0 .. n) é um dos itens da lista v[0 .. vn)? */
+static int proxy_listed(const char* v, size_t vn, const char* name, size_t n) {
+    size_t i = 0;
+    while (i < vn) {
+        while (i < vn && (v[i] == ' ' || v[i] == '\t' || v[i] == ',')) i++;
+        size_t s = i;
+        while (i < vn && v[i] != ' ' && v[i] != '\t' && v[i] != ',') i++;
+        if (i - s == n && n > 0 && strncasecmp(v + s, name, n) == 0) return 1;
+    }
+    return 0;
+}
+
+/* proxy_hop_by_hop: o header name do request r (em base) fica aqui? Além
+ * dos fixos, vale qualquer um que o Connection: do cliente tenha nomeado */
+static int proxy_hop_by_hop(const char* base, const struct http_request* r, struct http_slice name) {
+    const char* p = base + name.off;
+    for (size_t k = 0; k < sizeof(proxy_hop) / sizeof(proxy_hop[0]); k++) {
+        if (strlen(proxy_hop[k]) == name.len && strncasecmp(p, proxy_hop[k], name.len) == 0) return 1;
+    }
+    for (int h = 0; h < r->nheaders; h++) {
+        if (r->hname[h].len == 10 && strncasecmp(base + r->hname[h].off, "Connection", 10) == 0
+            && proxy_listed(base + r->hvalue[h].off, r->hvalue[h].len, p, name.len))
+            return 1;
+    }
+    return 0;
+}
+
+/* proxy_request: monta em out o request req[0 .. len) (analisado em r) como
+ * vai para o upstream: sempre HTTP/1.1 e keep-alive, sem os headers de
+ * salto a salto e com Host: se o cliente (HTTP/1.0) não mandou. Assim um
+ * cliente HTTP/1.0 ou com Connection: close não gasta uma conexão do pool;
+ * o keep-alive com o cliente é decidido à parte. Devolve o tamanho, 0 se
+ * não couber em cap. */
+static size_t proxy_request(char* out, size_t cap, const char* req, size_t len, const struct http_request* r) {
+    size_t host_len = strlen(config.upstream);
+    /* pior caso: cada linha ganha o \r, mais Host: e Connection: */
+    if (len + r->nheaders + 2 + host_len + 64 > cap) return 0;
+    size_t n = 0;
+    int has_host = 0;
+    memcpy(out + n, req + r->method.off, r->method.len);
+    n += r->method.len;
+    out[n++] = ' ';
+    memcpy(out + n, req + r->path.off, r->path.len);
+    n += r->path.len;
+    memcpy(out + n, " HTTP/1.1\r\n", 11);
+    n += 11;
+    for (int h = 0; h < r->nheaders; h++) {
+        struct http_slice name = r->hname[h], value = r->hvalue[h];
+        if (proxy_hop_by_hop(req, r, name)) continue;
+        if (name.len == 4 && strncasecmp(req + name.off, "Host", 4) == 0) has_host = 1;
+        memcpy(out + n, req + name.off, name.len);
+        n += name.len;
+        out[n++] = ':';
+        out[n++] = ' ';
+        memcpy(out + n, req + value.off, value.len);
+        n += value.len;
+        out[n++] = '\r';
+        out[n++] = '\n';
+    }
+    if (!has_host) n += sprintf(out + n, "Host: %s\r\n", config.upstream);
+    memcpy(out + n, "Connection: keep-alive\r\n\r\n", 26);
+    n += 26;
+    memcpy(out + n, req + r->header_len, len - r->header_len);   /* corpo */
+    return n + len - r->header_len;
+}
+
+/* proxy_start: c vai responder o request req[0 .. len) pelo upstream */
+static int proxy_start(struct conn* c, const char* req, size_t len) {
+    struct upstream* up = proxy_get();
+    if (up == NULL) return -1;
+    /* in[] anda com o pipeline: o request é remontado em up->req */
+    up->req_len = proxy_request(up->req, sizeof(up->req), req, len, &c->parser.req);
+    if (up->req_len == 0) {
+        proxy_close(up);
+        return -1;
+    }
+    up->sent = up->resp_len = up->piped = 0;
+    up->phase = UP_SENDING;
+    up->head_only = slice_eq(req, c->parser.req.method, "HEAD");
+    up->http10 = c->parser.req.minor_version == 0;
+    up->client = c;
+    c->up = up;
+    METRIC_ADD(proxied, 1);
+    return 0;
+}
+
+/* proxy_on_event: evento de um upstream (data.ptr com PROXY_TAG). Com
+ * cliente, avança a conexão dele e a devolve para o laço ver se terminou;
+ * ociosa no pool, o evento só pode ser o upstream fechando (ou mandando o
+ * que não foi pedido) e ela sai do pool. */
+struct conn* proxy_on_event(void* tagged) {
+    struct upstream* up = (struct upstream*)((char*)tagged - PROXY_TAG);
+    if (up->fd < 0) return NULL;   /* fechada antes, neste mesmo lote */
+    struct conn* c = up->client;
+    if (c != NULL) {
+        conn_drive(c);
+        return c;
+    }
+    char b;
+    if (recv(up->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return NULL;
+    struct upstream** p = &proxy_idle;
+    while (*p != up) p = &(*p)->next;
+    *p = up->next;
+    proxy_nidle--;
+    proxy_close(up);
+    return NULL;
+}
+
+/* proxy_token: o valor de um header contém tok (sem diferenciar caixa)? */
+static int proxy_token(const char* v, size_t n, const char* tok) {
+    size_t k = strlen(tok);
+    for (size_t i = 0; i + k <= n; i++) {
+        if (strncasecmp(v + i, tok, k) == 0) return 1;
+    }
+    return 0;
+}
+
+/* proxy_head: headers da resposta em resp[0 .. head); decide quanto corpo
+ * vem e se a conexão pode voltar ao pool. A linha Connection: (se houver)
+ * fica em resp[*conn_off .. *conn_end); *conn_end = 0 se não há. Para um
+ * cliente HTTP/1.0 o Transfer-Encoding: sai de resp[] (o corpo vai sem o
+ * enquadramento); devolve o novo tamanho dos headers. */
+static size_t proxy_head(struct upstream* up, size_t head, size_t* conn_off, size_t* conn_end) {
+    char* p = up->resp;
+    char* end = p + head;
+    int close = !(head > 12 && memcmp(p, "HTTP/1.1 ", 9) == 0);
+    int status = head > 12 ? atoi(p + 9) : 0;
+    int chunked = 0;
+    long long length = -1;
+    *conn_off = *conn_end = 0;
+    char* line = (char*)memchr(p, '\n', head) + 1;
+    while (line < end) {
+        char* eol = memchr(line, '\n', end - line);
+        size_t n = eol - line;
+        if (n > 15 && strncasecmp(line, "Content-Length:", 15) == 0)
+            length = strtoll(line + 15, NULL, 10);
+        else if (n > 18 && strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+            chunked = 1;
+            if (up->http10) {
+                memmove(line, eol + 1, up->resp_len - (eol + 1 - p));
+                up->resp_len -= n + 1;
+                end -= n + 1;
+                continue;
+            }
+        } else if (n > 11 && strncasecmp(line, "Connection:", 11) == 0) {
+            close = proxy_token(line + 11, n - 11, "close")
+                    || (close && !proxy_token(line + 11, n - 11, "keep-alive"));
+            *conn_off = line - p;
+            *conn_end = eol + 1 - p;
+        }
+        line = eol + 1;
+    }
+    up->chunked = 0;
+    if (up->head_only || status == 204 || status == 304) length = 0;
+    else if (chunked) {
+        length = -1;
+        up->chunked = 1;
+        up->ch_state = CH_SIZE;
+        up->ch_left = 0;
+        up->ch_line = 0;
+    }
+    up->body_left = length;
+    up->keep = (length >= 0 || up->chunked) && !close;
+    return end - p;
+}
+
+/* proxy_chunks: passa p[0 .. n), lido do upstream, pela máquina de estados
+ * do corpo chunked, que acha o fim da resposta sem depender de o upstream
+ * fechar. Devolve quanto de p segue para o cliente: até o fim do corpo, ou
+ * só os dados (compactados no começo de p) para um cliente HTTP/1.0. Bytes
+ * depois do fim ficam em *extra; ch_state = CH_BAD se o enquadramento não
+ * faz sentido. */
+static size_t proxy_chunks(struct upstream* up, char* p, size_t n, size_t* extra) {
+    size_t i = 0, out = 0;
+    while (i < n && up->ch_state < CH_DONE) {
+        if (up->ch_state == CH_DATA) {
+            size_t k = (long long)(n - i) < up->ch_left ? n - i : (size_t)up->ch_left;
+            if (up->http10) memmove(p + out, p + i, k);
+            out += k;
+            i += k;
+            up->ch_left -= k;
+            if (up->ch_left == 0) up->ch_state = CH_DATA_CR;
+            continue;
+        }
+        char ch = p[i++];
+        switch (up->ch_state) {
+        case CH_SIZE: {
+            int d = ch >= '0' && ch <= '9' ? ch - '0'
+                    : (ch | 0x20) >= 'a' && (ch | 0x20) <= 'f' ? (ch | 0x20) - 'a' + 10 : -1;
+            if (d >= 0 && up->ch_line < 15) {
+                up->ch_left = up->ch_left * 16 + d;
+                up->ch_line++;
+                break;
+            }
+            if (d >= 0 || up->ch_line == 0) {   /* grande demais ou sem dígitos */
+                up->ch_state = CH_BAD;
+                break;
+            }
+            up->ch_state = CH_EXT;
+        }
+            /* fall through */
+        case CH_EXT:
+            if (ch == '\n') {
+                /* o chunk 0 encerra os dados; depois vem o trailer */
+                up->ch_state = up->ch_left > 0 ? CH_DATA : CH_TRAILER;
+                up->ch_line = 0;
+            }
+            break;
+        case CH_DATA_CR:
+            up->ch_state = ch == '\r' ? CH_DATA_LF : ch == '\n' ? CH_SIZE : CH_BAD;
+            break;
+        case CH_DATA_LF:
+            up->ch_state = ch == '\n' ? CH_SIZE : CH_BAD;
+            break;
+        case CH_TRAILER:
+            if (ch == '\n') {
+                if (up->ch_line == 0) up->ch_state = CH_DONE;
+                up->ch_line = 0;
+            } else if (ch != '\r') {
+                up->ch_line++;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    *extra = n - i;
+    return up->http10 ? out : i;
+}
+
+/* proxy_fail: o upstream falhou antes dos headers da resposta. Conexão que
+ * veio do pool e não mandou nada pode ter sido fechada pelo upstream
+ * enquanto estava ociosa: reconecta e manda de novo, uma vez. Senão o
+ * cliente recebe 502; nada da resposta foi enviado, então a conexão dele
+ * segue o keep-alive do request. */
+static int proxy_fail(struct conn* c, const char* what) {
+    struct upstream* up = c->up;
+    if (up->reused && up->resp_len == 0) {
+        close(up->fd);
+        up->reused = 0;
+        up->sent = 0;
+        up->phase = UP_SENDING;
+        if (proxy_connect(up) == 0) return 1;
+    }
+    log_msg(LOG_CONN, "pid=%d connfd=%d: upstream %s: %s", (int)getpid(), c->fd, config.upstream, what);
+    METRIC_ADD(errors, 1);
+    proxy_put(up, 0);
+    c->up = NULL;
+    const struct static_response* resp = &route_error(502)->resp[!c->close_after];
+    c->out_cnt = date_iov(c->out, resp->buf, resp->len, resp->date_off, c->date);
+    c->out_idx = 0;
+    return 1;
+}
+
+/* proxy_relay: avança o request de c no upstream, com out[] já enviado.
+ * Devolve 1 se progrediu (out[] pode ter ganho o que enviar) e 0 se tem
+ * que esperar um evento (do cliente ou do upstream) ou a conexão acabou. */
+static int proxy_relay(struct conn* c) {
+    struct upstream* up = c->up;
+    ssize_t n;
+    if (up->phase == UP_SENDING) {
+        n = send(up->fd, up->req + up->sent, up->req_len - up->sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) return 1;
+            /* connect ainda em andamento ou buffer cheio */
+            if (errno == EAGAIN || errno == EWOULDBLOCK) goto wait;
+            return proxy_fail(c, strerror(errno));
+        }
+        up->sent += n;
+        if (up->sent == up->req_len) up->phase = UP_HEAD;
+        return 1;
+    }
+
+    if (up->phase == UP_HEAD) {
+        n = read(up->fd, up->resp + up->resp_len, sizeof(up->resp) - up->resp_len);
+        if (n == 0) return proxy_fail(c, "fechou antes da resposta");
+        if (n < 0) {
+            if (errno == EINTR) return 1;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) goto wait;
+            return proxy_fail(c, strerror(errno));
+        }
+        up->resp_len += n;
+        char* end = memmem(up->resp, up->resp_len, "\r\n\r\n", 4);
+        if (end == NULL)
+            return up->resp_len < sizeof(up->resp) ? 1 : proxy_fail(c, "headers grandes demais");
+        size_t head = end + 4 - up->resp;
+        size_t conn_off, conn_end;
+        head = proxy_head(up, head, &conn_off, &conn_end);
+        size_t body = up->resp_len - head;
+        if (up->chunked) {
+            size_t extra;
+            body = proxy_chunks(up, up->resp + head, body, &extra);
+            if (up->ch_state == CH_BAD) return proxy_fail(c, "corpo chunked inválido");
+            if (extra > 0) up->keep = 0;
+            /* sem o enquadramento, o fim do corpo é o fechamento */
+            if (up->http10) c->close_after = 1;
+        } else if (up->body_left >= 0) {
+            if ((long long)body > up->body_left) {
+                /* mandou além da resposta: não dá para reaproveitar */
+                body = up->body_left;
+                up->keep = 0;
+            }
+            up->body_left -= body;
+        }
+        if (!up->keep) c->close_after = 1;
+
+        /* Connection: é de salto a salto: sai a do upstream e entra a desta
+         * conexão com o cliente (sem iovec vazio no meio de out[]) */
+        static const char conn_close[] = "Connection: close\r\n\r\n";
+        static const char conn_keep[] = "Connection: keep-alive\r\n\r\n";
+        int k = 0;
+        size_t stop = conn_end ? conn_off : head - 2;
+        c->out[k++] = (struct iovec){ up->resp, stop };
+        if (conn_end && head - 2 > conn_end)
+            c->out[k++] = (struct iovec){ up->resp + conn_end, head - 2 - conn_end };
+        if (c->close_after) c->out[k++] = (struct iovec){ (char*)conn_close, sizeof(conn_close) - 1 };
+        else c->out[k++] = (struct iovec){ (char*)conn_keep, sizeof(conn_keep) - 1 };
+        if (body > 0) c->out[k++] = (struct iovec){ up->resp + head, body };
+        c->out_cnt = k;
+        c->out_idx = 0;
+        up->phase = UP_BODY;
+        return 1;
+    }
+
+    /* UP_BODY: esvazia o pipe e depois busca mais no upstream */
+    if (up->piped > 0) {
+        n = splice(up->pipe[0], NULL, c->fd, NULL, up->piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            if (errno == EINTR) return 1;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) goto wait;
+            perror("splice");
+            goto fail;
+        }
+        up->piped -= n;
+        METRIC_ADD(bytes_out, n);
+        return 1;
+    }
+    if (up->chunked ? up->ch_state == CH_DONE : up->body_left == 0) {
+        proxy_put(up, up->keep);
+        c->up = NULL;
+        return 1;
+    }
+    size_t want = up->body_left < 0 || up->body_left > PROXY_CHUNK ? PROXY_CHUNK : (size_t)up->body_left;
+    int use_splice = up->pipe[0] >= 0 && (c->ssl == NULL || c->tls_kernel);
+    /* no corpo chunked só os dados de um chunk vão por splice; tamanhos,
+     * CRLFs e trailer são lidos em resp[] para a máquina de estados */
+    if (up->chunked) {
+        use_splice = use_splice && up->ch_state == CH_DATA;
+        if (use_splice && up->ch_left < (long long)want) want = up->ch_left;
+    }
+    if (use_splice)
+        n = splice(up->fd, NULL, up->pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    else
+        n = read(up->fd, up->resp, want < sizeof(up->resp) ? want : sizeof(up->resp));
+    if (n == 0) {
+        if (up->body_left < 0 && !up->chunked) {   /* corpo delimitado pelo fechamento */
+            up->body_left = 0;
+            return 1;
+        }
+        log_msg(LOG_CONN, "pid=%d connfd=%d: upstream fechou no meio do corpo", (int)getpid(), c->fd);
+        goto fail;
+    }
+    if (n < 0) {
+        if (errno == EINTR) return 1;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) goto wait;
+        perror(use_splice ? "splice upstream" : "read upstream");
+        goto fail;
+    }
+    if (up->body_left > 0) up->body_left -= n;
+    if (use_splice) {
+        up->piped = n;
+        if (up->chunked && (up->ch_left -= n) == 0) up->ch_state = CH_DATA_CR;
+    } else {
+        if (up->chunked) {
+            size_t extra;
+            n = proxy_chunks(up, up->resp, n, &extra);
+            if (up->ch_state == CH_BAD) {
+                log_msg(LOG_CONN, "pid=%d connfd=%d: upstream mandou corpo chunked inválido", (int)getpid(), c->fd);
+                goto fail;
+            }
+            if (extra > 0) up->keep = 0;
+            if (n == 0) return 1;   /* só enquadramento: nada para o cliente */
+        }
+        c->out[0].iov_base = up->resp;
+        c->out[0].iov_len = n;
+        c->out_cnt = 1;
+        c->out_idx = 0;
+    }
+    return 1;
+
+wait:
+    /* o write_timeout vale também para o upstream parado */
+    timer_arm(c, TIMER_WRITE);
+    return 0;
+fail:
+    /* os headers já foram: só resta fechar o cliente */
+    METRIC_ADD(errors, 1);
+    c->state = CONN_DONE;
+    return 0;
+}
+
+/* ------------------ Conexões non-blocking (máquina de estados) ------------------ */
+
+/* now_ms: relógio monotônico em milissegundos */
+long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* now_us: relógio monotônico em microssegundos */
+long now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Roda de prazos (timing wheel) hierárquica, com tick de 1 ms.
+ *
+ * Cada nível tem WHEEL_SIZE listas; o nível L guarda os prazos que vencem
+ * entre 64^L e 64^(L+1) ms à frente, na posição dada pelos bits
+ * [6L, 6L+6) do instante de vencimento. Agendar e cancelar são O(1) (lista
+ * duplamente ligada, sem busca). A cada 64 ticks a posição corrente do
+ * nível 1 é "cascateada": as conexões dela voltam a ser inseridas e caem no
+ * nível 0, já na posição exata; o mesmo vale a cada 64^2 ticks para o
+ * nível 2 e assim por diante. Cada conexão desce no máximo WHEEL_LEVELS-1
+ * vezes, então o custo amortizado por prazo continua O(1). */
+
+static void wheel_link(struct conn** head, struct conn* c) {
+    c->tslot = head;
+    c->tprev = NULL;
+    c->tnext = *head;
+    if (*head) (*head)->tprev = c;
+    *head = c;
+}
+
+static void wheel_unlink(struct conn* c) {
+    if (c->tprev) c->tprev->tnext = c->tnext;
+    else *c->tslot = c->tnext;
+    if (c->tnext) c->tnext->tprev = c->tprev;
+    c->tslot = NULL;
+    c->tprev = c->tnext = NULL;
+}
+
+/* wheel_insert: põe c na lista do nível certo para c->expires */
+static void wheel_insert(struct conn_timers* t, struct conn* c) {
+    long delta = c->expires - t->now;
+    if (delta <= 0) {
+        wheel_link(&t->due, c);
+        return;
+    }
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1L << (WHEEL_BITS * (level + 1))) level++;
+    long at = c->expires;
+    long max = 1L << (WHEEL_BITS * WHEEL_LEVELS);
+    if (delta >= max) at = t->now + max - 1;   /* além do alcance: reavaliado na cascata */
+    wheel_link(&t->slots[level][(at >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)], c);
+    t->count++;
+}
+
+/* wheel_cascade: reinsere a posição corrente do nível level */
+static void wheel_cascade(struct conn_timers* t, int level) {
+    struct conn** head = &t->slots[level][(t->now >> (WHEEL_BITS * level)) & (WHEEL_SIZE - 1)];
+    struct conn* c = *head;
+    *head = NULL;
+    while (c) {
+        struct conn* next = c->tnext;
+        t->count--;
+        wheel_insert(t, c);
+        c = next;
+    }
+}
+
+/* wheel_advance: anda tick a tick até now, movendo os vencidos para due */
+static void wheel_advance(struct conn_timers* t, long now) {
+    if (t->count == 0) {
+        t->now = now > t->now ? now : t->now;
+        return;
+    }
+    while (t->now < now && t->count > 0) {
+        t->now++;
+        /* níveis mais altos primeiro: podem descer para a posição do nível
+         * de baixo que está sendo cascateada neste mesmo tick */
+        for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+            if ((t->now & ((1L << (WHEEL_BITS * level)) - 1)) == 0) wheel_cascade(t, level);
+        }
+        struct conn** head = &t->slots[0][t->now & (WHEEL_SIZE - 1)];
+        while (*head) {
+            struct conn* c = *head;
+            wheel_unlink(c);
+            t->count--;
+            wheel_link(&t->due, c);
+        }
+    }
+    if (t->now < now) t->now = now;
+}
+
+/* timer_cancel: tira c da roda (se estiver) */
+void timer_cancel(struct conn* c) {
+    if (c->tslot == NULL) {
+        c->tkind = TIMER_NONE;
+        return;
+    }
+    if (c->tslot != &c->timers->due) c->timers->count--;
+    wheel_unlink(c);
+    c->tkind = TIMER_NONE;
+}
+
+/* timer_arm: agenda o prazo kind de c (substitui o que houver) */
+void timer_arm(struct conn* c, enum timer_kind kind) {
+    struct conn_timers* t = c->timers;
+    timer_cancel(c);
+    if (t == NULL || t->timeout_ms[kind] <= 0) return;
+    long now = now_ms();
+    if (t->count == 0 && now > t->now) t->now = now;
+    c->tkind = kind;
+    c->expires = now + t->timeout_ms[kind];
+    wheel_insert(t, c);
+}
+
+/* timer_close: c terminou fora do próprio evento (p.ex. por um evento do
+ * upstream do proxy) e vai direto para due; o laço a fecha junto com os
+ * prazos vencidos. Se ainda houver evento dela no mesmo lote, ela fecha
+ * ali e conn_free a tira de due. */
+void timer_close(struct conn* c) {
+    timer_cancel(c);
+    c->tkind = TIMER_CLOSE;
+    wheel_link(&c->timers->due, c);
+}
+
+void conn_timers_init(struct conn_timers* t, int sleep_time) {
+    memset(t, 0, sizeof(*t));
+    t->now = now_ms();
+    t->timeout_ms[TIMER_HEADER] = config.header_timeout * 1000L;
+    t->timeout_ms[TIMER_IDLE] = config.keepalive_timeout * 1000L;
+    t->timeout_ms[TIMER_DELAY] = sleep_time * 1000L;
+    t->timeout_ms[TIMER_WRITE] = config.write_timeout * 1000L;
+}
+
+/* conn_timers_timeout: timeout em ms para select/poll/epoll (-1 = sem
+ * prazo). Procura a próxima posição ocupada de cada nível; para os níveis
+ * de cima o que importa é quando ela será cascateada (o laço acorda, desce
+ * as conexões e recalcula). No máximo WHEEL_LEVELS * WHEEL_SIZE posições. */
+int conn_timers_timeout(const struct conn_timers* t) {
+    if (t->due) return 0;
+    if (t->count == 0) return -1;
+    long now = now_ms();
+    long best = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_BITS * level;
+        long pos = t->now >> shift;
+        for (long k = 1; k <= WHEEL_SIZE; k++) {
+            if (t->slots[level][(pos + k) & (WHEEL_SIZE - 1)] == NULL) continue;
+            long at = (pos + k) << shift;
+            if (best < 0 || at < best) best = at;
+            break;
+        }
+    }
+    if (best < 0) return -1;
+    long left = best - now;
+    return left > 0 ? (int)(left < 3600000 ? left : 3600000) : 0;
+}
+
+/* conn_timers_expire: trata a próxima conexão cujo prazo venceu e a
+ * devolve (o laço então atualiza o interesse ou fecha); NULL = nenhuma */
+struct conn* conn_timers_expire(struct conn_timers* t, long now) {
+    if (t->due == NULL) wheel_advance(t, now);
+    struct conn* c = t->due;
+    if (c == NULL) return NULL;
+    enum timer_kind kind = c->tkind;
+    wheel_unlink(c);
+    c->tkind = TIMER_NONE;
+    if (kind == TIMER_DELAY) {
+        conn_on_timer(c);
+    } else {
+        if (kind != TIMER_IDLE && kind != TIMER_CLOSE)
+            log_msg(LOG_CONN, "pid=%d connfd=%d: prazo de %s vencido, fechando", (int)getpid(), c->fd,
+                    kind == TIMER_HEADER ? "request" : "envio");
+        if (kind == TIMER_WRITE) socket_abort(c->fd);
+        c->state = CONN_DONE;
+    }
+    return c;
+}
+
+/* conn_wait_read: a conexão vai esperar mais bytes do cliente. Sem request
+ * pela metade, o buffer de leitura volta ao pool. O prazo entre requests de
+ * uma conexão keep-alive é keepalive_timeout; numa conexão nova ou com
+ * request começado vale header_timeout, contado do começo e não renovado a
+ * cada byte (um cliente que manda um byte por vez não segura a conexão). */
+static void conn_wait_read(struct conn* c) {
+    if (c->in_len == 0) {
+        slab_put(&in_pool, c->in);
+        c->in = NULL;
+    }
+    enum timer_kind kind = (c->in_len == 0 && c->requests > 0) ? TIMER_IDLE : TIMER_HEADER;
+    if (c->tkind != kind) timer_arm(c, kind);
+}
+
+/* conn_new: conexão nova registrada em table (NULL = sem memória) */
+struct conn* conn_new(int fd, struct conn_timers* timers, struct conn_table* table) {
+    struct conn* c = slab_get(&conn_pool);
+    if (!c) return NULL;
+    c->fd = fd;
+    c->table = NULL;
+    if (table && conn_table_add(table, c) < 0) {
+        slab_put(&conn_pool, c);
+        return NULL;
+    }
+    c->state = CONN_READING_HEADERS;
+    c->in = NULL;
+    c->in_len = 0;
+    http_parser_init(&c->parser);
+    c->out_cnt = c->out_idx = 0;
+    c->close_after = 0;
+    c->requests = 0;
+    c->file = NULL;
+    c->store = NULL;
+    c->dyn = NULL;
+    c->up = NULL;
+    c->batch = 0;
+    c->uring_ops = 0;
+    c->slot = -1;
+    c->timers = timers;
+    c->tkind = TIMER_NONE;
+    c->tslot = NULL;
+    c->tprev = c->tnext = NULL;
+    c->expires = 0;
+    c->ssl = NULL;
+    c->tls_flip = c->tls_kernel = c->tls_failed = 0;
+    if (tls_enabled() && tls_attach(c) < 0) {
+        conn_table_del(c);
+        slab_put(&conn_pool, c);
+        return NULL;
+    }
+    timer_arm(c, TIMER_HEADER);   /* conectou (ou começou o handshake) e não mandou nada */
+    return c;
+}
+
+void conn_free(struct conn* c) {
+    if (!c) return;
+    timer_cancel(c);
+    if (c->file) file_release(c->file);
+    if (c->store) store_ref_put(c->store);
+    free(c->dyn);
+    if (c->up) proxy_put(c->up, 0);
+    tls_free(c);
+    conn_table_del(c);
+    if (c->fd >= 0) Close(c->fd);
+    METRIC_ADD(closed, 1);
+    slab_put(&in_pool, c->in);
+    slab_put(&conn_pool, c);
+}
+
+/* conn_queue_response: responde ao request in[off .. off+len), cujo
+ * resultado de http_parse é result */
+static void conn_queue_response(struct conn* c, size_t off, size_t len, int result) {
+    char* req = c->in + off;
+    log_request(req, len);
+
+    /* erro e o último request permitido encerram a conexão */
+    c->requests++;
+    c->batch++;
+    METRIC_ADD(requests, 1);
+    int keepalive = c->parser.req.keepalive && c->requests < (unsigned)config.keepalive_max;
+    const struct store_entry* e = NULL;
+    struct file_entry* f = NULL;
+    size_t dyn_len = 0;
+    int bad_gateway = 0;
+    if (result == HTTP_OK && metrics_match(req, &c->parser.req)) {
+        c->dyn = metrics_response(keepalive, &dyn_len);
+    } else if (result == HTTP_OK && proxy_match(req, &c->parser.req)) {
+        if (proxy_start(c, req, len) == 0) {
+            /* nada em out[]: a resposta vem do upstream depois dele */
+            if (!keepalive) c->close_after = 1;
+            http_parser_init(&c->parser);
+            return;
+        }
+        bad_gateway = 1;
+    } else if (result == HTTP_OK && slice_eq(req, c->parser.req.method, "GET")
+             && (e = store_lookup(req, c->parser.req.path)) == NULL) {
+        f = file_lookup(req, c->parser.req.path);
+    }
+
+    if (c->dyn != NULL) {
+        c->out[c->out_cnt].iov_base = c->dyn;
+        c->out[c->out_cnt].iov_len = dyn_len;
+    } else if (e != NULL) {
+        /* a arena fica viva enquanto out[] apontar para ela */
+        if (c->store == NULL) {
+            c->store = store_mine;
+            c->store->users++;
+        }
+        /* iovec vazio no meio de out[] travaria o avanço do writev */
+        c->out_cnt += date_iov(c->out + c->out_cnt, e->hdr[keepalive].iov_base, e->hdr[keepalive].iov_len,
+                               e->date_off[keepalive], c->date) - 1;
+        if (e->body.iov_len > 0) c->out[++c->out_cnt] = e->body;
+    } else if (f != NULL) {
+        /* headers vão no writev; o corpo segue por sendfile */
+        c->file = f;
+        c->file_off = 0;
+        c->file_left = f->st.st_size;
+        c->out[c->out_cnt].iov_base = c->hdr;
+        c->out[c->out_cnt].iov_len = file_header(c->hdr, sizeof(c->hdr), f, keepalive);
+        if (c->file_left == 0) {
+            file_release(f);
+            c->file = NULL;
+        }
+    } else {
+        struct route* rt = bad_gateway ? route_error(502) : route_find(req, &c->parser.req, result);
+        /* 400/431 (e corpo grande demais, que vira 400): o enquadramento se
+         * perdeu e não dá para achar o próximo request. 404/405 de um
+         * request bem formado seguem o keep-alive negociado */
+        if (result != HTTP_OK) keepalive = 0;
+        if (rt->status >= 400 && rt->status < 500) METRIC_ADD(resp_4xx, 1);
+        const struct static_response* resp = &rt->resp[keepalive];
+        c->out_cnt += date_iov(c->out + c->out_cnt, resp->buf, resp->len, resp->date_off, c->date) - 1;
+    }
+    c->out_cnt++;
+    if (!keepalive) c->close_after = 1;
+    http_parser_init(&c->parser);
+}
+
+/* conn_start_write: respostas de out[] prontas; envia agora ou, se houver
+ * sleep_time, agenda o envio na roda de prazos do laço */
+static void conn_start_write(struct conn* c) {
+    c->out_idx = 0;
+    if (metrics_table) c->started_us = now_us();
+    if (c->timers && c->timers->timeout_ms[TIMER_DELAY] > 0) {
+        c->state = CONN_DELAYED;
+        timer_arm(c, TIMER_DELAY);
+        return;
+    }
+    timer_cancel(c);
+    c->state = CONN_WRITING;
+}
+
+/* conn_parse: retoma o parser sobre o buffer, enfileira a resposta de cada
+ * request completo (em pipeline podem ser vários) e devolve 1 se há o que
+ * enviar. Um request incompleto continua na próxima leitura. */
+static int conn_parse(struct conn* c) {
+    size_t off = 0;
+    c->out_cnt = 0;
+    /* out[] anterior já foi enviado: a data pode mudar */
+    if (config.date) memcpy(c->date, date_now, DATE_LEN);
+    /* um arquivo (ou resposta montada, ou request do proxy) por vez: o corpo
+     * dele vai depois de todo o out[] */
+    while (c->out_cnt + 4 <= (int)(sizeof(c->out) / sizeof(c->out[0])) && !c->close_after && c->file == NULL && c->dyn == NULL
+           && c->up == NULL && off < c->in_len) {
+        int r = http_parse(&c->parser, c->in + off, c->in_len - off);
+        if (r == HTTP_AGAIN) break;
+        size_t len = (r == HTTP_OK) ? c->parser.req.total_len : c->in_len - off;
+        conn_queue_response(c, off, len, r);
+        off += len;
+    }
+    if (c->out_cnt == 0 && c->up == NULL) return 0;
+
+    /* o que sobrou é o início do próximo request em pipeline; os offsets
+     * do parser são relativos ao início do request, então continuam válidos */
+    memmove(c->in, c->in + off, c->in_len - off);
+    c->in_len -= off;
+    conn_start_write(c);
+    return 1;
+}
+
+/* conn_on_readable: processa o que já está no buffer e lê tudo o que
+ * estiver disponível (necessário em edge-triggered) até EAGAIN */
+void conn_on_readable(struct conn* c) {
+    while (c->state == CONN_READING_HEADERS) {
+        if (conn_parse(c)) break;
+        if (c->in == NULL && (c->in = slab_get(&in_pool)) == NULL) {
+            METRIC_ADD(errors, 1);
+            c->state = CONN_DONE;
+            break;
+        }
+        ssize_t n = conn_recv(c, c->in + c->in_len, MAXLINE - c->in_len);
+        if (n > 0) {
+            c->in_len += n;
+            METRIC_ADD(bytes_in, n);
+        } else if (n == 0) {
+            /* cliente fechou a escrita no meio de um request */
+            if (c->in_len > 0) {
+                conn_queue_response(c, 0, c->in_len, HTTP_BAD);
+                c->in_len = 0;
+                conn_start_write(c);
+            } else {
+                c->state = CONN_DONE;
+            }
+        } else {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("read");
+                METRIC_ADD(errors, 1);
+                c->state = CONN_DONE;
+            } else {
+                conn_wait_read(c);
+            }
+            break;
+        }
+    }
+}
+
+/* conn_on_writable: envia out[] com writev e depois o arquivo, se houver,
+ * com sendfile, ou a resposta do upstream do proxy, até terminar ou o
+ * socket encher */
+void conn_on_writable(struct conn* c) {
+    while (c->state == CONN_WRITING) {
+        if (c->out_idx < c->out_cnt) {
+            ssize_t n = conn_writev(c, c->out + c->out_idx, c->out_cnt - c->out_idx);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) { /* espera ficar gravável */
+                    timer_arm(c, TIMER_WRITE);
+                    return;
+                }
+                perror("write => erro: não foi possível enviar a mensagem ao cliente");
+                METRIC_ADD(errors, 1);
+                c->state = CONN_DONE;
+                return;
+            }
+            METRIC_ADD(bytes_out, n);
+            /* avança sobre as entradas já enviadas; a parcial é ajustada */
+            while (n > 0 && c->out_idx < c->out_cnt) {
+                struct iovec* v = &c->out[c->out_idx];
+                if ((size_t)n >= v->iov_len) {
+                    n -= v->iov_len;
+                    c->out_idx++;
+                } else {
+                    v->iov_base = (char*)v->iov_base + n;
+                    v->iov_len -= n;
+                    n = 0;
+                }
+            }
+        } else if (c->file != NULL) {
+            ssize_t n = conn_sendfile(c);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    timer_arm(c, TIMER_WRITE);
+                    return;
+                }
+                perror("sendfile");
+                METRIC_ADD(errors, 1);
+                c->state = CONN_DONE;
+                return;
+            }
+            if (n == 0) {
+                /* arquivo encolheu depois do fstat: o Content-Length já foi */
+                c->state = CONN_DONE;
+                return;
+            }
+            c->file_left -= n;
+            METRIC_ADD(bytes_out, n);
+            if (c->file_left == 0) {
+                file_release(c->file);
+                c->file = NULL;
+            }
+        } else if (c->up != NULL) {
+            if (!proxy_relay(c)) return;
+        } else {
+            break;
+        }
+    }
+    if (c->state != CONN_WRITING) return;
+    if (c->store) {
+        store_ref_put(c->store);
+        c->store = NULL;
+    }
+    if (c->dyn) {
+        free(c->dyn);
+        c->dyn = NULL;
+    }
+    if (metrics_table) metrics_latency(now_us() - c->started_us, c->batch);
+    c->batch = 0;
+    c->out_cnt = c->out_idx = 0;
+    if (c->tkind == TIMER_WRITE) timer_cancel(c);
+    c->state = c->close_after ? CONN_DONE : CONN_READING_HEADERS;
+}
+
+/* conn_on_timer: prazo do sleep_time venceu, começa a enviar */
+void conn_on_timer(struct conn* c) {
+    c->state = CONN_WRITING;
+    conn_drive(c);
+}
+
+/* conn_drive: avança a máquina de estados até a conexão bloquear (EAGAIN),
+ * ficar esperando um prazo ou terminar */
+void conn_drive(struct conn* c) {
+    for (;;) {
+        enum conn_state before = c->state;
+        if (c->state == CONN_READING_HEADERS) conn_on_readable(c);
+        else if (c->state == CONN_WRITING) conn_on_writable(c);
+        if (c->state == before) break;
+    }
+}
+
+/* ------------------ UDP em lote (recvmmsg/sendmmsg, modo 3) ------------------ */
+
+/* Cada wakeup do socket UDP lê até udp_batch datagramas com um recvmmsg e
+ * responde a todos com um sendmmsg: dois syscalls por lote em vez de dois
+ * por pacote. Com sleep_time os requests vão para um anel com o instante
+ * de envio (o atraso é igual para todos, então o anel já fica em ordem) e
+ * são respondidos em lote quando vencem, sem travar o laço; com o anel
+ * cheio o datagrama é descartado.
+ *
+ * Os requests seguem struct udp_frame: a rota é procurada no content
+ * store (store_max=N), depois nas rotas estáticas, e /echo devolve o
+ * payload. O corpo não é copiado: os iovecs apontam para a arena do store,
+ * para a rota ou para o próprio buffer do lote, intercalados com os
+ * cabeçalhos de cada pedaço.
+ *
+ * Onde o kernel suporta (e udp_offload=1), o lote ainda passa por offload:
+ *  - UDP_GRO: datagramas seguidos do mesmo remetente e do mesmo tamanho
+ *    chegam agregados numa entrada só, com o tamanho de cada um num cmsg;
+ *    a entrada é fatiada de volta em requests aqui.
+ *  - UDP_SEGMENT (GSO): datagramas seguidos para o mesmo destino viram uma
+ *    mensagem só, que o kernel corta em segmentos iguais (o último pode
+ *    ser menor). Os pedaços de uma resposta grande e respostas repetidas
+ *    do mesmo tamanho se encaixam nisso naturalmente. */
+
+static const char udp_response[] = "HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nOK";
+
+#define UDP_RESP_LEN (sizeof(udp_response) - 1)
+#define UDP_CTL_SIZE CMSG_SPACE(sizeof(int))
+
+static void* udp_alloc(size_t n, size_t size) {
+    void* p = calloc(n, size);
+    if (p == NULL) {
+        perror("calloc udp");
+        exit(1);
+    }
+    return p;
+}
+
+/* udp_offload_init: liga GRO e testa GSO no socket; o que falhar fica
+ * desligado e o caminho sem offload continua valendo */
+static void udp_offload_init(struct udp_engine* u) {
+    if (!config.udp_offload) return;
+    int one = 1;
+    u->gro = setsockopt(u->fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == 0;
+    int seg;
+    socklen_t len = sizeof(seg);
+    u->gso = getsockopt(u->fd, SOL_UDP, UDP_SEGMENT, &seg, &len) == 0;
+}
+
+void udp_engine_init(struct udp_engine* u, int fd, int sleep_time, const char* tag) {
+    int batch = config.udp_batch;
+    if (batch < 1) batch = 1;
+    if (batch > UDP_BATCH_MAX) batch = UDP_BATCH_MAX;
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+    u->batch = batch;
+    u->delay_ms = sleep_time * 1000L;
+    u->tag = tag;
+    udp_offload_init(u);
+    u->buf_size = u->gro ? UDP_GRO_BUF : MAXLINE;
+    u->in = udp_alloc(batch, sizeof(*u->in));
+    u->in_iov = udp_alloc(batch, sizeof(*u->in_iov));
+    u->bufs = udp_alloc(batch, u->buf_size);
+    u->in_ctl = udp_alloc(batch, UDP_CTL_SIZE);
+    u->from = udp_alloc(batch, sizeof(*u->from));
+    u->out = udp_alloc(batch, sizeof(*u->out));
+    u->out_ctl = udp_alloc(batch, UDP_CTL_SIZE);
+    u->out_segs = udp_alloc(batch, sizeof(*u->out_segs));
+    u->out_seg = udp_alloc(batch, sizeof(*u->out_seg));
+    u->out_bytes = udp_alloc(batch, sizeof(*u->out_bytes));
+    /* um lote de respostas de um datagrama, mais uma resposta inteira */
+    u->iov_cap = 2 * batch + 2 * UDP_FRAG_MAX;
+    u->iov = udp_alloc(u->iov_cap, sizeof(*u->iov));
+    u->hdr_cap = batch + UDP_FRAG_MAX;
+    u->hdr = udp_alloc(u->hdr_cap, sizeof(*u->hdr));
+    if (u->delay_ms > 0) u->pend = udp_alloc(UDP_PENDING_MAX, sizeof(*u->pend));
+    for (int i = 0; i < batch; i++) {
+        u->in_iov[i].iov_base = u->bufs + (size_t)i * u->buf_size;
+        u->in_iov[i].iov_len = u->buf_size;
+        u->in[i].msg_hdr.msg_iov = &u->in_iov[i];
+        u->in[i].msg_hdr.msg_iovlen = 1;
+        u->in[i].msg_hdr.msg_name = &u->from[i];
+        u->in[i].msg_hdr.msg_control = u->in_ctl + i * UDP_CTL_SIZE;
+    }
+    log_msg(LOG_SERVER, "%s offload UDP: GSO %s, GRO %s", tag,
+            u->gso ? "sim" : "não", u->gro ? "sim" : "não");
+}
+
+/* udp_gro_size: tamanho de cada datagrama de uma entrada agregada pelo
+ * GRO (0 = entrada com um datagrama só) */
+int udp_gro_size(struct msghdr* h) {
+    for (struct cmsghdr* cm = CMSG_FIRSTHDR(h); cm != NULL; cm = CMSG_NXTHDR(h, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int size;
+            memcpy(&size, CMSG_DATA(cm), sizeof(size));
+            return size;
+        }
+    }
+    return 0;
+}
+
+static int udp_same_peer(const struct msghdr* h, const void* addr) {
+    const struct sockaddr_in* a = h->msg_name;
+    const struct sockaddr_in* b = addr;
+    return a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr;
+}
+
+/* udp_send_split: manda a mensagem k datagrama por datagrama (sem GSO) */
+static void udp_send_split(struct udp_engine* u, int k) {
+    struct msghdr h = u->out[k].msg_hdr;
+    struct iovec* end = h.msg_iov + h.msg_iovlen;
+    h.msg_control = NULL;
+    h.msg_controllen = 0;
+    for (struct iovec* v = h.msg_iov; v < end;) {
+        size_t len = 0;
+        h.msg_iov = v;
+        while (v < end && len < u->out_seg[k]) len += (v++)->iov_len;
+        h.msg_iovlen = v - h.msg_iov;
+        if (sendmsg(u->fd, &h, 0) == (ssize_t)len) METRIC_ADD(bytes_out, len);
+        else METRIC_ADD(errors, 1);
+    }
+}
+
+/* udp_send: envia out[] inteiro (sendmmsg pode parar no meio do lote).
+ * Se o GSO for recusado no envio (EIO: a interface não faz checksum por
+ * conta própria), desliga e manda o resto datagrama por datagrama. */
+static void udp_send(struct udp_engine* u) {
+    for (int i = 0; i < u->nout; i++) {
+        struct msghdr* h = &u->out[i].msg_hdr;
+        if (u->out_segs[i] > 1) {
+            char* ctl = u->out_ctl + i * UDP_CTL_SIZE;
+            h->msg_control = ctl;
+            h->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cm = CMSG_FIRSTHDR(h);
+            cm->cmsg_level = SOL_UDP;
+            cm->cmsg_type = UDP_SEGMENT;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t seg = u->out_seg[i];
+            memcpy(CMSG_DATA(cm), &seg, sizeof(seg));
+        } else {
+            h->msg_control = NULL;
+            h->msg_controllen = 0;
+        }
+    }
+    int off = 0;
+    while (off < u->nout) {
+        int r = sendmmsg(u->fd, u->out + off, u->nout - off, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EIO && u->gso) {
+                log_msg(LOG_SERVER, "%s GSO recusado no envio, desligando", u->tag);
+                u->gso = 0;
+                for (; off < u->nout; off++) udp_send_split(u, off);
+                break;
+            }
+            perror("sendmmsg");
+            for (; off < u->nout; off++) METRIC_ADD(errors, u->out_segs[off]);
+            break;
+        }
+        for (int i = off; i < off + r; i++) METRIC_ADD(bytes_out, u->out_bytes[i]);
+        off += r;
+    }
+    u->nout = u->niov = u->nhdr = 0;
+}
+
+/* udp_datagram: mais um datagrama (cabeçalho opcional + dados) para addr
+ * no próximo sendmmsg; com GSO ele entra na última mensagem se o destino
+ * for o mesmo e o tamanho couber no segmento dela */
+static void udp_datagram(struct udp_engine* u, void* addr, socklen_t addr_len,
+                         const struct udp_frame* hdr, const void* data, size_t len) {
+    int need = (hdr != NULL) + (len > 0);
+    if (u->niov + need > u->iov_cap || u->nhdr == u->hdr_cap) udp_send(u);
+
+    size_t dlen = (hdr ? sizeof(*hdr) : 0) + len;
+    int k = u->nout - 1;
+    if (!(u->gso && k >= 0 && u->out_segs[k] < UDP_GSO_SEGS
+          && u->out_bytes[k] % u->out_seg[k] == 0 && dlen <= u->out_seg[k]
+          && u->out_bytes[k] + dlen <= UDP_GSO_BYTES && udp_same_peer(&u->out[k].msg_hdr, addr))) {
+        if (u->nout == u->batch) udp_send(u);
+        k = u->nout++;
+        struct msghdr* h = &u->out[k].msg_hdr;
+        h->msg_name = addr;
+        h->msg_namelen = addr_len;
+        h->msg_iov = &u->iov[u->niov];
+        h->msg_iovlen = 0;
+        u->out_segs[k] = 0;
+        u->out_seg[k] = dlen;
+        u->out_bytes[k] = 0;
+    }
+    struct msghdr* h = &u->out[k].msg_hdr;
+    if (hdr != NULL) {
+        u->hdr[u->nhdr] = *hdr;
+        u->iov[u->niov++] = (struct iovec){ &u->hdr[u->nhdr++], sizeof(*hdr) };
+    }
+    if (len > 0) u->iov[u->niov++] = (struct iovec){ (void*)data, len };
+    h->msg_iovlen += need;
+    u->out_segs[k]++;
+    u->out_bytes[k] += dlen;
+}
+
+/* udp_frame_get: o datagrama é do protocolo? (cabeçalho convertido em f) */
+static int udp_frame_get(const char* data, size_t len, struct udp_frame* f) {
+    if (len < sizeof(*f)) return 0;
+    memcpy(f, data, sizeof(*f));
+    if (ntohs(f->magic) != UDP_MAGIC) return 0;
+    f->id = ntohl(f->id);
+    f->status = ntohs(f->status);
+    f->route_len = ntohs(f->route_len);
+    f->frag = ntohs(f->frag);
+    f->nfrags = ntohs(f->nfrags);
+    return 1;
+}
+
+/* udp_route: corpo da resposta à rota de um request; devolve o status */
+static int udp_route(const char* data, const struct udp_frame* f, size_t len,
+                     const void** body, size_t* body_len) {
+    const char* route = data + sizeof(*f);
+    const char* payload = route + f->route_len;
+    size_t rlen = f->route_len;
+    *body = NULL;
+    *body_len = 0;
+    if (f->route_len > len - sizeof(*f)) return 400;
+    if (rlen == 5 && memcmp(route, "/echo", 5) == 0) {
+        *body = payload;
+        *body_len = len - sizeof(*f) - rlen;
+        return 200;
+    }
+    const struct store_entry* e = store_lookup(data, (struct http_slice){ sizeof(*f), rlen });
+    if (e != NULL) {
+        *body = e->body.iov_base;
+        *body_len = e->body.iov_len;
+        return 200;
+    }
+    for (int i = 0; i < nroutes; i++) {
+        if (routes[i].path == NULL || strlen(routes[i].path) != rlen
+            || memcmp(routes[i].path, route, rlen) != 0)
+            continue;
+        *body = routes[i].body;
+        *body_len = strlen(routes[i].body);
+        return 200;
+    }
+    return 404;
+}
+
+/* udp_answer: responde um request (recebido agora ou vindo do anel) */
+static void udp_answer(struct udp_engine* u, void* addr, socklen_t addr_len, const char* data, size_t len) {
+    struct udp_frame f;
+    if (!udp_frame_get(data, len, &f)) {
+        udp_datagram(u, addr, addr_len, NULL, udp_response, UDP_RESP_LEN);
+        return;
+    }
+    const void* body = NULL;
+    size_t body_len = 0;
+    int status;
+    if (len > UDP_FRAG_SIZE) status = 413;
+    else if (f.version != UDP_VERSION || f.type != UDP_REQUEST) status = 400;
+    else status = udp_route(data, &f, len, &body, &body_len);
+    if (body_len > UDP_FRAG_MAX * UDP_FRAG_DATA) {
+        status = 413;
+        body_len = 0;
+    }
+
+    int nfrags = body_len ? (body_len + UDP_FRAG_DATA - 1) / UDP_FRAG_DATA : 1;
+    struct udp_frame r = {
+        .magic = htons(UDP_MAGIC), .version = UDP_VERSION, .type = UDP_REPLY,
+        .id = htonl(f.id), .status = htons(status), .nfrags = htons(nfrags),
+    };
+    for (int i = 0; i < nfrags; i++) {
+        size_t off = (size_t)i * UDP_FRAG_DATA;
+        size_t n = body_len - off < UDP_FRAG_DATA ? body_len - off : UDP_FRAG_DATA;
+        r.frag = htons(i);
+        udp_datagram(u, addr, addr_len, &r, (const char*)body + off, body_len ? n : 0);
+    }
+}
+
+/* udp_request: um datagrama recebido (ou um pedaço de uma entrada do GRO) */
+static void udp_request(struct udp_engine* u, struct msghdr* h, const char* data, size_t len, long now) {
+    METRIC_ADD(requests, 1);
+    if (log_on(LOG_CONN)) {
+        const struct sockaddr_in* sin = h->msg_name;
+        struct udp_frame f;
+        if (udp_frame_get(data, len, &f) && f.route_len <= len - sizeof(f))
+            log_text("%s from %pI4:%d -> #%u %.*s (%zu bytes)", u->tag, &sin->sin_addr, ntohs(sin->sin_port),
+                     f.id, (int)(f.route_len < 200 ? f.route_len : 200), data + sizeof(f), len);
+        else
+            log_text("%s from %pI4:%d -> %.*s", u->tag, &sin->sin_addr, ntohs(sin->sin_port),
+                     (int)(len < 200 ? len : 200), data);
+    }
+    if (u->delay_ms <= 0) {
+        udp_answer(u, h->msg_name, h->msg_namelen, data, len);
+    } else if (u->pend_tail - u->pend_head < UDP_PENDING_MAX) {
+        struct udp_pending* p = &u->pend[u->pend_tail++ % UDP_PENDING_MAX];
+        memcpy(&p->addr, h->msg_name, h->msg_namelen);
+        p->addr_len = h->msg_namelen;
+        p->due = now + u->delay_ms;
+        p->len = len;
+        memcpy(p->data, data, len < UDP_FRAG_SIZE ? len : UDP_FRAG_SIZE);
+    } else {
+        METRIC_ADD(errors, 1);   /* anel cheio: descarta */
+    }
+}
+
+/* udp_on_readable: lê um lote e responde (ou enfileira, com sleep_time) */
+void udp_on_readable(struct udp_engine* u) {
+    for (int i = 0; i < u->batch; i++) {
+        u->in[i].msg_hdr.msg_namelen = sizeof(u->from[i]);
+        u->in[i].msg_hdr.msg_controllen = UDP_CTL_SIZE;
+    }
+    int n = recvmmsg(u->fd, u->in, u->batch, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            perror("recvmmsg");
+            METRIC_ADD(errors, 1);
+        }
+        return;
+    }
+    long now = u->delay_ms > 0 ? now_ms() : 0;
+    for (int i = 0; i < n; i++) {
+        struct msghdr* h = &u->in[i].msg_hdr;
+        const char* data = h->msg_iov->iov_base;
+        size_t len = u->in[i].msg_len;
+        METRIC_ADD(bytes_in, len);
+        if (h->msg_flags & MSG_TRUNC) METRIC_ADD(errors, 1);
+        size_t seg = u->gro ? (size_t)udp_gro_size(h) : 0;
+        if (seg == 0) seg = len ? len : 1;
+        for (size_t off = 0; off == 0 || off < len; off += seg)
+            udp_request(u, h, data + off, len - off < seg ? len - off : seg, now);
+    }
+    if (u->nout > 0) udp_send(u);
+}
+
+/* udp_timeout: ms até a próxima resposta adiada (-1 = nenhuma) */
+int udp_timeout(const struct udp_engine* u) {
+    if (u->pend_head == u->pend_tail) return -1;
+    long left = u->pend[u->pend_head % UDP_PENDING_MAX].due - now_ms();
+    return left > 0 ? (int)left : 0;
+}
+
+/* udp_flush_due: envia, em lotes, as respostas adiadas que venceram */
+void udp_flush_due(struct udp_engine* u, long now) {
+    while (u->pend_head != u->pend_tail) {
+        struct udp_pending* p = &u->pend[u->pend_head % UDP_PENDING_MAX];
+        if (p->due > now) break;
+        u->pend_head++;
+        udp_answer(u, &p->addr, p->addr_len, p->data, p->len);
+    }
+    if (u->nout > 0) udp_send(u);
+}
+
+/* udp_worker: laço de uma thread UDP (udp_workers=N) */
+static void* udp_worker(void* arg) {
+    struct udp_engine* u = arg;
+    struct pollfd pfd = { .fd = u->fd, .events = POLLIN };
+    log_msg(LOG_SERVER, "%s pid=%d thread UDP iniciada (udpfd=%d, lote de %d)",
+            u->tag, (int)getpid(), u->fd, u->batch);
+    for (;;) {
+        store_sync();
+        int r = poll(&pfd, 1, udp_timeout(u));
+        if (r < 0 && errno != EINTR) {
+            perror("poll udp");
+            break;
+        }
+        if (r > 0) udp_on_readable(u);
+        udp_flush_due(u, now_ms());
+    }
+    return NULL;
+}
+
+/* udp_start_workers: config.udp_workers threads, cada uma com um socket UDP
+ * na porta de udpfd (que já veio com SO_REUSEPORT); o kernel espalha os
+ * datagramas entre eles pelo hash do remetente */
+void udp_start_workers(int udpfd, int sleep_time) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(udpfd, (struct sockaddr*)&addr, &len) < 0) {
+        perror("getsockname udp");
+        exit(1);
+    }
+    struct udp_engine* us = udp_alloc(config.udp_workers, sizeof(*us));
+    for (int i = 0; i < config.udp_workers; i++) {
+        int fd = udpfd;
+        if (i > 0) {
+            fd = socket(AF_INET, SOCK_DGRAM, 0);
+            if (fd < 0) {
+                perror("socket udp");
+                exit(1);
+            }
+            Setsocketopt(fd);
+            Setsocketopt_reuseport(fd);
+            if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+                perror("bind udp");
+                exit(1);
+            }
+        }
+        udp_engine_init(&us[i], fd, sleep_time, "[UDP]");
+        int err = pthread_create(&us[i].thread, NULL, udp_worker, &us[i]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+        pthread_detach(us[i].thread);
+    }
+}
+
+/* ------------------ Implementações de multiplexação ------------------ */
+
+/* Conjunto de fds para select() sem o teto de FD_SETSIZE: o kernel aceita
+ * bitmaps de qualquer tamanho desde que nfds os acompanhe, mas as macros
+ * FD_* não (com _FORTIFY_SOURCE abortam em fd >= FD_SETSIZE). */
+struct fd_bits {
+    unsigned long* w;
+    int nwords;
+};
+
+#define FD_BITS_WORD (8 * (int)sizeof(unsigned long))
+
+/* fd_bits_reserve: garante espaço para fd (-1 = sem memória) */
+static int fd_bits_reserve(struct fd_bits* b, int fd) {
+    int need = fd / FD_BITS_WORD + 1;
+    if (need <= b->nwords) return 0;
+    int n = b->nwords ? b->nwords : 1;
+    while (n < need) n *= 2;
+    unsigned long* w = realloc(b->w, n * sizeof(*w));
+    if (w == NULL) return -1;
+    memset(w + b->nwords, 0, (n - b->nwords) * sizeof(*w));
+    b->w = w;
+    b->nwords = n;
+    return 0;
+}
+
+static void fd_bits_set(struct fd_bits* b, int fd) {
+    b->w[fd / FD_BITS_WORD] |= 1UL << (fd % FD_BITS_WORD);
+}
+
+static void fd_bits_clr(struct fd_bits* b, int fd) {
+    b->w[fd / FD_BITS_WORD] &= ~(1UL << (fd % FD_BITS_WORD));
+}
+
+static int fd_bits_isset(const struct fd_bits* b, int fd) {
+    return (b->w[fd / FD_BITS_WORD] >> (fd % FD_BITS_WORD)) & 1;
+}
+
+/* fd_bits_copy: dst = src (dst cresce junto) */
+static int fd_bits_copy(struct fd_bits* dst, const struct fd_bits* src) {
+    if (fd_bits_reserve(dst, src->nwords * FD_BITS_WORD - 1) < 0) return -1;
+    memcpy(dst->w, src->w, src->nwords * sizeof(*src->w));
+    return 0;
+}
+
+/* select_track: ajusta os conjuntos de c conforme o estado da conexão */
+static void select_track(struct conn* c, struct fd_bits* rall, struct fd_bits* wall) {
+    fd_bits_clr(rall, c->fd);
+    fd_bits_clr(wall, c->fd);
+    if (c->state == CONN_READING_HEADERS) fd_bits_set(c->tls_flip ? wall : rall, c->fd);
+    else if (c->state == CONN_WRITING) fd_bits_set(c->tls_flip ? rall : wall, c->fd);
+}
+
+/* select_loop: laço select() comum aos modos 1 e 3; udpfd < 0 = só TCP.
+ * As conexões ficam na tabela indexada por fd; a varredura vai de 0 a
+ * maxfd, como o próprio select faz no kernel. */
+static void select_loop(int listenfd, int udpfd, int sleep_time, const char* tag) {
+    int maxfd;
+    struct conn_table table;
+    struct conn_timers timers;
+    struct fd_bits rall = { 0 }, wall = { 0 }, rset = { 0 }, wset = { 0 };
+    struct udp_engine udp;
+
+    conn_timers_init(&timers, sleep_time);
+    conn_table_init(&table, config.max_conns);
+    if (udpfd >= 0) udp_engine_init(&udp, udpfd, sleep_time, "[UDP]");
+
+    maxfd = listenfd > udpfd ? listenfd : udpfd;
+    if (fd_bits_reserve(&rall, FD_SETSIZE - 1) < 0 || fd_bits_reserve(&wall, FD_SETSIZE - 1) < 0
+        || fd_bits_reserve(&rall, maxfd) < 0) {
+        perror("malloc");
+        exit(1);
+    }
+    if (udpfd >= 0) fd_bits_set(&rall, udpfd);
+
+    log_msg(LOG_SERVER, "%s pid=%d modo select iniciado (listenfd=%d udpfd=%d)",
+            tag, (int)getpid(), listenfd, udpfd);
+
+    for (;;) {
+        /* tabela cheia: o listenfd sai do select e os clientes esperam na
+         * fila do listen até alguma conexão fechar */
+        if (conn_table_accepting(&table, tag)) fd_bits_set(&rall, listenfd);
+        else fd_bits_clr(&rall, listenfd);
+        if (fd_bits_copy(&rset, &rall) < 0 || fd_bits_copy(&wset, &wall) < 0) {
+            perror("malloc");
+            break;
+        }
+        struct timeval tv, *tvp = NULL;
+        int timeout = conn_timers_timeout(&timers);
+        if (udpfd >= 0) {
+            int t = udp_timeout(&udp);
+            if (t >= 0 && (timeout < 0 || t < timeout)) timeout = t;
+        }
+        if (timeout >= 0) {
+            tv.tv_sec = timeout / 1000;
+            tv.tv_usec = (timeout % 1000) * 1000;
+            tvp = &tv;
+        }
+        store_sync();   /* antes de bloquear: um SIGHUP chega como EINTR */
+        int nready = select(maxfd + 1, (fd_set*)rset.w, (fd_set*)wset.w, NULL, tvp);
+        if (nready < 0) {
+            if (errno == EINTR) continue;
+            perror("select");
+            break;
+        }
+
+        /* prazos vencidos (ver enum timer_kind); o estado novo é
+         * aplicado aos conjuntos na varredura de clientes abaixo */
+        struct conn* c;
+        long now = now_ms();
+        date_tick(now);
+        while ((c = conn_timers_expire(&timers, now)) != NULL)
+            ;
+
+        /* datagramas UDP: um lote por wakeup, mais as respostas adiadas */
+        if (udpfd >= 0) {
+            if (fd_bits_isset(&rset, udpfd)) {
+                udp_on_readable(&udp);
+                nready--;
+            }
+            udp_flush_due(&udp, now);
+        }
+
+        /* new TCP connection? */
+        if (fd_bits_isset(&rset, listenfd)) {
+            int connfd = Accept_nb(listenfd);
+            if (connfd < 0) {
+                if (errno == EMFILE || errno == ENFILE) accept_starved(&table);
+            } else if (fd_bits_reserve(&rall, connfd) < 0 || fd_bits_reserve(&wall, connfd) < 0
+                       || (c = conn_new(connfd, &timers, &table)) == NULL) {
+                log_msg(LOG_SERVER, "%s out of memory, closing new conn", tag);
+                Close_unserved(connfd);
+            } else {
+                fd_bits_set(&rall, connfd);
+                if (connfd > maxfd) maxfd = connfd;
+                log_msg(LOG_CONN, "%s accepted connfd=%d (%d conexões)", tag, connfd, table.count);
+            }
+            nready--;
+        }
+
+        /* existing TCP clients: lê, escreve ou fecha conforme o estado */
+        int last = maxfd < table.cap ? maxfd : table.cap - 1;
+        for (int fd = 0; fd <= last; fd++) {
+            c = table.by_fd[fd];
+            if (c == NULL) continue;
+            if (nready > 0 && (fd_bits_isset(&rset, fd) || fd_bits_isset(&wset, fd))) {
+                conn_drive(c);
+                nready--;
+            }
+            if (c->state == CONN_DONE) {
+                log_msg(LOG_CONN, "%s pid=%d closing connfd=%d", tag, (int)getpid(), fd);
+                fd_bits_clr(&rall, fd);
+                fd_bits_clr(&wall, fd);
+                conn_free(c);
+            } else {
+                select_track(c, &rall, &wall);
+            }
+        }
+    }
+}
+
+/* servidor usando select() — single-process */
+void server_with_select(int listenfd, int sleep_time) {
+    select_loop(listenfd, -1, sleep_time, "[select]");
+}
+
+/* poll_events: eventos de interesse de c conforme o estado da conexão */
+static short poll_events(const struct conn* c) {
+    if (c->state == CONN_READING_HEADERS) return c->tls_flip ? POLLWRNORM : POLLRDNORM;
+    if (c->state == CONN_WRITING) return c->tls_flip ? POLLRDNORM : POLLWRNORM;
+    return 0;
+}
+
+/* Vetor de pollfd do modo 2, sempre compacto: [0] é o listenfd e [1, n)
+ * são as conexões vivas, então poll() recebe exatamente o conjunto vivo.
+ * Uma conexão nova entra no fim; ao fechar, a última entrada vem para o
+ * lugar dela (swap-remove). c->slot é a posição de c e, com a tabela por
+ * fd, dá o caminho fd -> slot: inserir e remover são O(1). */
+struct poll_set {
+    struct pollfd* fds;
+    int n;                  /* entradas em uso */
+    int cap;
+};
+
+/* poll_add: põe c no fim do vetor (-1 = sem memória) */
+static int poll_add(struct poll_set* ps, struct conn* c) {
+    if (ps->n == ps->cap) {
+        struct pollfd* fds = realloc(ps->fds, 2 * ps->cap * sizeof(*fds));
+        if (fds == NULL) return -1;
+        ps->fds = fds;
+        ps->cap *= 2;
+    }
+    c->slot = ps->n++;
+    ps->fds[c->slot].fd = c->fd;
+    ps->fds[c->slot].events = POLLRDNORM;
+    ps->fds[c->slot].revents = 0;
+    return 0;
+}
+
+/* poll_remove: tira o slot i trazendo a última entrada para ele (com o
+ * revents dela, que ainda não foi tratado) */
+static void poll_remove(struct poll_set* ps, struct conn_table* t, int i) {
+    int last = --ps->n;
+    if (i != last) {
+        ps->fds[i] = ps->fds[last];
+        t->by_fd[ps->fds[i].fd]->slot = i;
+    }
+}
+
+/* poll_settle: fecha a conexão do slot i se ela terminou (devolve 1: o
+ * slot passa a ter outra entrada) ou ajusta events (devolve 0) */
+static int poll_settle(struct poll_set* ps, struct conn_table* t, int i) {
+    struct conn* c = t->by_fd[ps->fds[i].fd];
+    if (c->state == CONN_DONE) {
+        log_msg(LOG_CONN, "[poll] pid=%d closing connfd=%d (client[%d])",
+                (int)getpid(), c->fd, i);
+        conn_free(c);
+        poll_remove(ps, t, i);
+        return 1;
+    }
+    ps->fds[i].events = poll_events(c);
+    return 0;
+}
+
+/* servidor usando poll() — single-process */
+void server_with_poll(int listenfd, int sleep_time) {
+    int i, connfd;
+    int nready;
+    struct conn_table table;
+    struct conn_timers timers;
+    struct poll_set ps = { .fds = malloc(64 * sizeof(struct pollfd)), .n = 1, .cap = 64 };
+    if (!ps.fds) {
+        perror("malloc");
+        exit(1);
+    }
+
+    conn_timers_init(&timers, sleep_time);
+    conn_table_init(&table, config.max_conns);
+    ps.fds[0].fd = listenfd;
+    ps.fds[0].events = POLLRDNORM;
+
+    log_msg(LOG_SERVER, "[poll] pid=%d modo poll iniciado (listenfd=%d)", (int)getpid(), listenfd);
 
     for (;;) {
-        rset = allset;
-        int nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
+        /* tabela cheia: sem POLLRDNORM no listenfd, os clientes esperam na
+         * fila do listen até alguma conexão fechar */
+        ps.fds[0].events = conn_table_accepting(&table, "[poll]") ? POLLRDNORM : 0;
+        store_sync();   /* antes de bloquear: um SIGHUP chega como EINTR */
+        nready = poll(ps.fds, ps.n, conn_timers_timeout(&timers));
         if (nready < 0) {
             if (errno == EINTR) continue;
-            perror("select");
+            perror("poll");
             break;
         }
 
-        if (FD_ISSET(listenfd, &rset)) {
-            int connfd = Accept(listenfd);
-            if (connfd >= 0) {
-                for (i = 0; i < FD_SETSIZE; i++) {
-                    if (clients[i] < 0) {
-                        clients[i] = connfd;
-                        break;
-                    }
-                }
-                if (i == FD_SETSIZE) {
-                    echo_servidor("[select] too many clients, closing new conn");
-                    Close(connfd);
-                } else {
-                    FD_SET(connfd, &allset);
-                    if (connfd > maxfd) maxfd = connfd;
-                    snprintf(buf, sizeof(buf), "[select] accepted connfd=%d stored at clients[%d]", connfd, i);
-                    echo_servidor(buf);
-                }
+        /* prazos vencidos (ver enum timer_kind) */
+        struct conn* c;
+        long now = now_ms();
+        date_tick(now);
+        while ((c = conn_timers_expire(&timers, now)) != NULL) {
+            i = c->slot;
+            ps.fds[i].revents = 0;
+            poll_settle(&ps, &table, i);
+        }
+
+        if (ps.fds[0].revents & POLLRDNORM) {
+            connfd = Accept_nb(listenfd);
+            if (connfd < 0) {
+                if (errno == EMFILE || errno == ENFILE) accept_starved(&table);
+            } else if ((c = conn_new(connfd, &timers, &table)) == NULL) {
+                echo_servidor("[poll] out of memory, closing new conn");
+                Close_unserved(connfd);
+            } else if (poll_add(&ps, c) < 0) {
+                echo_servidor("[poll] out of memory, closing new conn");
+                conn_free(c);
+            } else {
+                log_msg(LOG_CONN, "[poll] accepted connfd=%d into client[%d]", connfd, c->slot);
             }
-            if (--nready <= 0) continue;
         }
 
-        for (i = 0; i < FD_SETSIZE; i++) {
-            int sockfd = clients[i];
-            if (sockfd < 0) continue;
-            if (FD_ISSET(sockfd, &rset)) {
-                snprintf(buf, sizeof(buf), "[select] pid=%d handling connfd=%d (clients[%d])", (int)getpid(), sockfd, i);
-                echo_servidor(buf);
-                process_request(sockfd, sleep_time);
-                Close(sockfd);
-                FD_CLR(sockfd, &allset);
-                clients[i] = -1;
-                if (--nready <= 0) break;
+        /* um slot que fecha recebe a última entrada, então é visto de novo */
+        for (i = 1; i < ps.n;) {
+            if (ps.fds[i].revents == 0) {
+                i++;
+                continue;
             }
+            c = table.by_fd[ps.fds[i].fd];
+            short re = ps.fds[i].revents;
+            ps.fds[i].revents = 0;
+            conn_drive(c);
+            if ((re & POLLNVAL) || ((re & POLLERR) && c->state != CONN_DELAYED))
+                c->state = CONN_DONE;
+            if (!poll_settle(&ps, &table, i)) i++;
         }
     }
+
+    free(ps.fds);
 }
 
-/* servidor usando poll() — single-process */
-void server_with_poll(int listenfd, int sleep_time) {
-    int i, maxi, connfd, sockfd;
-    int nready;
-    const int max_clients = 1024; /* razoável para exercício */
-    struct pollfd *clients = calloc(max_clients, sizeof(struct pollfd));
-    if (!clients) {
-        perror("calloc");
+/* servidor que trata TCP e UDP com select() no mesmo processo */
+void server_tcp_udp_select(int listenfd, int udpfd, int sleep_time) {
+    select_loop(listenfd, udpfd, sleep_time, "[tcp+udp select]");
+}
+
+/* ------------------ Reactor epoll (modos 4 e 5) ------------------ */
+
+/* reactor_accept: aceita o que estiver na fila do listen. Devolve 1 se a
+ * fila esvaziou (EAGAIN) e 0 se parou com a tabela cheia: em
+ * edge-triggered não vem outro aviso para essas conexões, então o laço
+ * chama de novo quando alguma conexão fechar. */
+static int reactor_accept(struct reactor* r) {
+    struct epoll_event ev;
+    while (conn_table_accepting(&r->table, r->tag)) {
+        int connfd = Accept_nb(r->listenfd);
+        if (connfd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EMFILE || errno == ENFILE) {
+                accept_starved(&r->table);
+                if (r->table.starved) continue;   /* sai pelo teste do while */
+            } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("accept");
+            }
+            return 1;
+        }
+        struct conn* nc = conn_new(connfd, &r->timers, &r->table);
+        if (!nc) {
+            log_msg(LOG_SERVER, "%s out of memory, closing new conn", r->tag);
+            Close_unserved(connfd);
+            continue;
+        }
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = nc;
+        if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0) {
+            perror("epoll_ctl connfd");
+            conn_free(nc);
+            continue;
+        }
+        log_msg(LOG_CONN, "%s reactor %d accepted connfd=%d", r->tag, r->id, connfd);
+    }
+    return 0;
+}
+
+/* reactor_run: laço de eventos epoll edge-triggered de um reactor
+ *
+ * Cada evento traz o ponteiro da struct conn em data.ptr, então o custo de
+ * um wakeup é proporcional ao número de sockets prontos e não ao tamanho
+ * da tabela de clientes. O listenfd é registrado com data.ptr = NULL e as
+ * conexões com o upstream do proxy com o bit PROXY_TAG no ponteiro.
+ * Cada conexão é registrada uma única vez com EPOLLIN|EPOLLOUT; como em
+ * edge-triggered só chega aviso em mudança de estado, o envio adiado pelo
+ * sleep_time é tentado direto quando o prazo vence. */
+void* reactor_run(void* arg) {
+    struct reactor* r = arg;
+    struct epoll_event ev, events[MAX_EVENTS];
+
+    int backlog_pending = 0;     /* ficou conexão na fila do listen */
+
+    conn_timers_init(&r->timers, r->sleep_time);
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd < 0) {
+        perror("epoll_create1");
+        exit(1);
+    }
+    proxy_epfd = r->epfd;   /* o pool de upstreams da thread usa este epoll */
+
+    set_nonblocking(r->listenfd);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->listenfd, &ev) < 0) {
+        perror("epoll_ctl listenfd");
         exit(1);
     }
 
-    for (i = 0; i < max_clients; i++) clients[i].fd = -1;
-    clients[0].fd = listenfd;
-    clients[0].events = POLLRDNORM;
-    maxi = 0;
+    if (r->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(r->cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            log_msg(LOG_SERVER, "%s pthread_setaffinity_np(cpu=%d): %s", r->tag, r->cpu, strerror(err));
+        }
+    }
 
-    char buf[128];
-    snprintf(buf, sizeof(buf), "[poll] pid=%d modo poll iniciado (listenfd=%d)", (int)getpid(), listenfd);
-    echo_servidor(buf);
+    log_msg(LOG_SERVER, "%s pid=%d reactor %d iniciado (listenfd=%d, cpu=%d)",
+            r->tag, (int)getpid(), r->id, r->listenfd, r->cpu);
 
     for (;;) {
-        nready = poll(clients, maxi + 1, -1);
+        store_sync();   /* antes de bloquear: um SIGHUP chega como EINTR */
+        int nready = epoll_wait(r->epfd, events, MAX_EVENTS, conn_timers_timeout(&r->timers));
         if (nready < 0) {
             if (errno == EINTR) continue;
-            perror("poll");
+            perror("epoll_wait");
             break;
         }
+        date_tick(now_ms());
 
-        if (clients[0].revents & POLLRDNORM) {
-            connfd = Accept(listenfd);
-            if (connfd >= 0) {
-                for (i = 1; i < max_clients; i++) {
-                    if (clients[i].fd < 0) {
-                        clients[i].fd = connfd;
-                        clients[i].events = POLLRDNORM;
-                        break;
-                    }
+        for (int i = 0; i < nready; i++) {
+            struct conn* c = events[i].data.ptr;
+
+            if (c == NULL) {
+                /* edge-triggered: aceita tudo o que estiver na fila */
+                backlog_pending = !reactor_accept(r);
+                continue;
+            }
+            if ((uintptr_t)c & PROXY_TAG) {
+                /* o cliente pode ter evento mais adiante no lote: fecha no fim */
+                c = proxy_on_event(c);
+                if (c != NULL && c->state == CONN_DONE) timer_close(c);
+                continue;
+            }
+
+            uint32_t e = events[i].events;
+            conn_drive(c);
+            if ((e & EPOLLERR) && c->state != CONN_DELAYED)
+                c->state = CONN_DONE;
+
+            if (c->state == CONN_DONE) {
+                log_msg(LOG_CONN, "%s pid=%d reactor %d closing connfd=%d",
+                        r->tag, (int)getpid(), r->id, c->fd);
+                /* close() remove o fd do epoll automaticamente */
+                conn_free(c);
+            }
+        }
+
+        /* prazos vencidos (ver enum timer_kind) */
+        struct conn* c;
+        long now = now_ms();
+        while ((c = conn_timers_expire(&r->timers, now)) != NULL) {
+            if (c->state == CONN_DONE) {
+                log_msg(LOG_CONN, "%s pid=%d reactor %d closing connfd=%d",
+                        r->tag, (int)getpid(), r->id, c->fd);
+                conn_free(c);
+            }
+        }
+
+        proxy_reap();
+
+        /* accept pausado com a tabela cheia: retoma se alguém fechou */
+        if (backlog_pending && r->table.count < r->table.max && !r->table.starved)
+            backlog_pending = !reactor_accept(r);
+    }
+
+    close(r->epfd);
+    return NULL;
+}
+
+/* servidor usando epoll() edge-triggered — single-process */
+void server_with_epoll(int listenfd, int sleep_time) {
+    struct reactor r = { .id = 0, .listenfd = listenfd, .sleep_time = sleep_time,
+                         .cpu = -1, .tag = "[epoll]" };
+    conn_table_init(&r.table, config.max_conns);
+    reactor_run(&r);
+}
+
+/* cpu_of_worker: n-ésima CPU permitida ao processo (circular) */
+static int cpu_of_worker(int n) {
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return -1;
+    int count = CPU_COUNT(&allowed);
+    if (count == 0) return -1;
+    n %= count;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && n-- == 0) return cpu;
+    }
+    return -1;
+}
+
+/* reactor_count: reactors do modo 5 (workers=N ou CPUs online) */
+int reactor_count(void) {
+    int n = config.workers;
+    if (n <= 0) n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/* servidor multi-thread: um reactor epoll por thread, cada um com o seu
+ * próprio listening socket na mesma porta (SO_REUSEPORT). O kernel
+ * distribui as conexões novas entre os sockets, então não há accept
+ * compartilhado nem lock entre as threads. O listenfd recebido já deve
+ * ter SO_REUSEPORT ligado antes do bind e fica com o reactor 0. */
+void server_with_reuseport(int listenfd, int backlog, int sleep_time) {
+    int nworkers = reactor_count();
+
+    struct sockaddr_in servaddr;
+    socklen_t len = sizeof(servaddr);
+    if (getsockname(listenfd, (struct sockaddr*)&servaddr, &len) < 0) {
+        perror("getsockname");
+        exit(1);
+    }
+
+    struct reactor* rs = calloc(nworkers, sizeof(struct reactor));
+    if (!rs) {
+        perror("calloc");
+        exit(1);
+    }
+
+    for (int i = 0; i < nworkers; i++) {
+        rs[i].id = i;
+        rs[i].sleep_time = sleep_time;
+        /* o kernel espalha as conexões entre os listen sockets, então cada
+         * reactor fica com a sua parte do limite */
+        conn_table_init(&rs[i].table, config.max_conns / nworkers);
+        rs[i].cpu = config.pin_cpu ? cpu_of_worker(i) : -1;
+        rs[i].tag = "[reuseport]";
+        if (i == 0) {
+            rs[i].listenfd = listenfd;
+            continue;
+        }
+        rs[i].listenfd = Socket();
+        Setsocketopt(rs[i].listenfd);
+        Setsocketopt_reuseport(rs[i].listenfd);
+        Bind(rs[i].listenfd, ntohs(servaddr.sin_port));
+        Listen(rs[i].listenfd, backlog);
+    }
+
+    log_msg(LOG_SERVER, "[reuseport] pid=%d iniciando %d reactors (pin_cpu=%d)",
+            (int)getpid(), nworkers, config.pin_cpu);
+
+    for (int i = 1; i < nworkers; i++) {
+        int err = pthread_create(&rs[i].thread, NULL, reactor_run, &rs[i]);
+        if (err != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            exit(1);
+        }
+    }
+    /* a thread principal vira o reactor 0 */
+    reactor_run(&rs[0]);
+
+    for (int i = 1; i < nworkers; i++) pthread_join(rs[i].thread, NULL);
+    free(rs);
+}
+
+/* ------------------ Modo 6: io_uring ------------------ */
+
+/* Em vez de esperar prontidão e depois chamar accept/read/write, o laço
+ * entrega as operações ao kernel e colhe os resultados:
+ *  - um accept multishot no listenfd gera um CQE por conexão nova;
+ *  - recv com IOSQE_BUFFER_SELECT pega um buffer do ring de buffers
+ *    registrado (IORING_REGISTER_PBUF_RING) só quando chegam dados, e o
+ *    buffer volta ao ring assim que é copiado para c->in;
+ *  - as respostas saem com IORING_OP_SENDMSG sobre out[]; quando a
+ *    conexão vai fechar, um IORING_OP_CLOSE vai ligado (IOSQE_IO_LINK) ao
+ *    envio, e os dois são submetidos juntos.
+ * Um io_uring_enter submete tudo o que a volta anterior gerou e espera os
+ * próximos CQEs. Não usa liburing: o pouco que o laço precisa (mmap dos
+ * rings, SQE, CQE) está em uring_*. Sem suporte no kernel (io_uring
+ * desligado, kernel < 5.19) o modo cai para o epoll do modo 4. */
+
+/* tags nos bits baixos do user_data (struct conn vem do conn_pool, alinhada
+ * em SLAB_ALIGN) */
+enum { UR_ACCEPT = 1, UR_RECV = 2, UR_SEND = 3, UR_POLL = 4, UR_CLOSE = 5, UR_CANCEL = 6,
+       UR_TAG_MASK = 7 };
+
+static int uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void* arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* uring_init: cria o ring e registra os buffers de recepção; -1 = sem
+ * suporte (o chamador cai para epoll) */
+static int uring_init(struct uring* u) {
+    struct io_uring_params p;
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = UR_CQ_ENTRIES;
+    u->fd = uring_setup(UR_SQ_ENTRIES, &p);
+    if (u->fd < 0) return -1;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        close(u->fd);
+        return -1;
+    }
+
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->ring_len = sq_len > cq_len ? sq_len : cq_len;
+    u->ring = mmap(NULL, u->ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQ_RING);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   u->fd, IORING_OFF_SQES);
+    if (u->ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        close(u->fd);
+        return -1;
+    }
+    char* r = u->ring;
+    u->sq_head = (unsigned*)(r + p.sq_off.head);
+    u->sq_tail = (unsigned*)(r + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(r + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    unsigned* array = (unsigned*)(r + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) array[i] = i;
+    u->cq_head = (unsigned*)(r + p.cq_off.head);
+    u->cq_tail = (unsigned*)(r + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(r + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(r + p.cq_off.cqes);
+    u->tail = *u->sq_tail;
+
+    /* ring de buffers para os recv (grupo 0) */
+    u->bufs = malloc((size_t)UR_NBUFS * UR_BUF_SIZE);
+    u->br = mmap(NULL, UR_NBUFS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->bufs == NULL || u->br == MAP_FAILED) {
+        close(u->fd);
+        return -1;
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)u->br;
+    reg.ring_entries = UR_NBUFS;
+    reg.bgid = 0;
+    if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        close(u->fd);
+        return -1;
+    }
+    u->br->tail = 0;
+    for (unsigned bid = 0; bid < UR_NBUFS; bid++) {
+        struct io_uring_buf* b = &u->br->bufs[bid];
+        b->addr = (unsigned long)(u->bufs + (size_t)bid * UR_BUF_SIZE);
+        b->len = UR_BUF_SIZE;
+        b->bid = bid;
+    }
+    __atomic_store_n(&u->br->tail, UR_NBUFS, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* uring_buf_recycle: devolve o buffer bid ao ring */
+static void uring_buf_recycle(struct uring* u, unsigned bid) {
+    unsigned short tail = u->br->tail;
+    struct io_uring_buf* b = &u->br->bufs[tail & (UR_NBUFS - 1)];
+    b->addr = (unsigned long)(u->bufs + (size_t)bid * UR_BUF_SIZE);
+    b->len = UR_BUF_SIZE;
+    b->bid = bid;
+    __atomic_store_n(&u->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/* uring_submit: publica os SQEs preenchidos e, com wait, espera pelo
+ * menos um CQE ou timeout_ms (-1 = sem prazo) */
+static int uring_submit(struct uring* u, int wait, int timeout_ms) {
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+    unsigned flags = 0, min_complete = 0;
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    memset(&arg, 0, sizeof(arg));
+    if (wait) {
+        flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        min_complete = 1;
+        if (timeout_ms >= 0) {
+            ts.tv_sec = timeout_ms / 1000;
+            ts.tv_nsec = (timeout_ms % 1000) * 1000000L;
+            arg.ts = (unsigned long)&ts;
+        }
+    }
+    unsigned to_submit = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    return uring_enter(u->fd, to_submit, min_complete, flags, wait ? &arg : NULL, wait ? sizeof(arg) : 0);
+}
+
+/* uring_sqe: próximo SQE livre (zerado); submete antes se o SQ encheu */
+static struct io_uring_sqe* uring_sqe(struct uring* u) {
+    while (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+        uring_submit(u, 0, 0);
+    struct io_uring_sqe* sqe = &u->sqes[u->tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->tail++;
+    return sqe;
+}
+
+/* uring_prep_accept: accept multishot (um SQE, vários CQEs) ou de uma
+ * conexão só */
+static void uring_prep_accept(struct uring* u, int listenfd, int multi) {
+    struct io_uring_sqe* sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenfd;
+    if (multi) sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = UR_ACCEPT;
+    u->accept_armed = 1;
+    u->accept_multi = multi;
+    u->accept_cancel = 0;
+}
+
+/* uring_accept_gate: ajusta o accept ao espaço na tabela. O multishot
+ * aceita no kernel, sem passar pelo laço, então só é usado com folga de
+ * UR_ACCEPT_SLACK conexões; perto do limite ele é cancelado e o laço passa
+ * a pedir uma conexão por vez, e com a tabela cheia não pede nenhuma (as
+ * conexões novas esperam na fila do listen). */
+static void uring_accept_gate(struct uring* u, int listenfd, struct conn_table* t) {
+    int accepting = conn_table_accepting(t, "[uring]");
+    int multi = t->max - t->count > UR_ACCEPT_SLACK;
+    if (!u->accept_armed) {
+        if (accepting) uring_prep_accept(u, listenfd, multi);
+    } else if (u->accept_multi && !multi && !u->accept_cancel) {
+        struct io_uring_sqe* sqe = uring_sqe(u);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = UR_ACCEPT;
+        sqe->user_data = UR_CANCEL;
+        u->accept_cancel = 1;
+    }
+}
+
+/* uring_settle: submete o que o estado de c pede (como select_track e
+ * poll_settle nos outros modos) e libera c quando não resta nada */
+static void uring_settle(struct uring* u, struct conn* c) {
+    if (c->state == CONN_DONE) {
+        if (c->uring_ops == 0) {
+            if (c->fd >= 0) log_msg(LOG_CONN, "[uring] pid=%d closing connfd=%d", (int)getpid(), c->fd);
+            conn_free(c);
+        } else if (c->fd >= 0 && !(c->uring_ops & (1u << UR_CLOSE))) {
+            /* acorda o recv/poll pendente; o CQE dele libera a conexão */
+            shutdown(c->fd, SHUT_RDWR);
+        }
+        return;
+    }
+
+    if (c->state == CONN_READING_HEADERS && !(c->uring_ops & (1u << UR_RECV))) {
+        conn_wait_read(c);
+        struct io_uring_sqe* sqe = uring_sqe(u);
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = c->fd;
+        sqe->len = MAXLINE - c->in_len < UR_BUF_SIZE ? MAXLINE - c->in_len : UR_BUF_SIZE;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = 0;
+        sqe->user_data = (unsigned long)c | UR_RECV;
+        c->uring_ops |= 1u << UR_RECV;
+    } else if (c->state == CONN_WRITING && !(c->uring_ops & (1u << UR_SEND | 1u << UR_POLL))) {
+        timer_arm(c, TIMER_WRITE);   /* renovado a cada envio submetido */
+        struct io_uring_sqe* sqe = uring_sqe(u);
+        if (c->out_idx < c->out_cnt) {
+            memset(&c->msg, 0, sizeof(c->msg));
+            c->msg.msg_iov = c->out + c->out_idx;
+            c->msg.msg_iovlen = c->out_cnt - c->out_idx;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = c->fd;
+            sqe->addr = (unsigned long)&c->msg;
+            sqe->len = 1;
+            sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+            sqe->user_data = (unsigned long)c | UR_SEND;
+            c->uring_ops |= 1u << UR_SEND;
+            if (c->close_after && c->file == NULL && !(c->uring_ops & (1u << UR_CLOSE))) {
+                /* última resposta: o close vai junto, ligado ao envio */
+                sqe->flags |= IOSQE_IO_LINK;
+                struct io_uring_sqe* cl = uring_sqe(u);
+                cl->opcode = IORING_OP_CLOSE;
+                cl->fd = c->fd;
+                cl->user_data = (unsigned long)c | UR_CLOSE;
+                c->uring_ops |= 1u << UR_CLOSE;
+            }
+        } else {
+            /* só falta o corpo do arquivo: sendfile encheu o socket */
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = c->fd;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = (unsigned long)c | UR_POLL;
+            c->uring_ops |= 1u << UR_POLL;
+        }
+    }
+}
+
+/* uring_complete: trata um CQE de operação de conexão */
+static void uring_complete(struct uring* u, struct conn* c, int tag, int res, unsigned flags) {
+    c->uring_ops &= ~(1u << tag);
+
+    if (tag == UR_CLOSE) {
+        /* res != 0: o envio falhou e o close foi cancelado; conn_free fecha */
+        if (res == 0) {
+            log_msg(LOG_CONN, "[uring] pid=%d closed connfd=%d", (int)getpid(), c->fd);
+            conn_table_del(c);
+            c->fd = -1;
+        }
+    } else if (tag == UR_RECV) {
+        if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            METRIC_ADD(bytes_in, res);
+            if (c->state == CONN_READING_HEADERS) {
+                if (c->in == NULL && (c->in = slab_get(&in_pool)) == NULL) {
+                    METRIC_ADD(errors, 1);
+                    c->state = CONN_DONE;
+                } else {
+                    memcpy(c->in + c->in_len, u->bufs + (size_t)bid * UR_BUF_SIZE, res);
+                    c->in_len += res;
+                    conn_parse(c);
                 }
-                if (i == max_clients) {
-                    echo_servidor("[poll] too many clients");
-                    Close(connfd);
+            }
+            uring_buf_recycle(u, bid);
+        } else if (res == -ENOBUFS || res == -EINTR || res == -EAGAIN) {
+            /* sem buffer livre agora: o settle abaixo tenta de novo */
+        } else if (c->state == CONN_READING_HEADERS) {
+            /* EOF ou erro; request pela metade ainda recebe o 400 */
+            if (res == 0 && c->in_len > 0) {
+                conn_queue_response(c, 0, c->in_len, HTTP_BAD);
+                c->in_len = 0;
+                conn_start_write(c);
+            } else {
+                if (res < 0) METRIC_ADD(errors, 1);
+                c->state = CONN_DONE;
+            }
+        }
+    } else if (tag == UR_SEND) {
+        if (res < 0) {
+            if (res != -EINTR && res != -EAGAIN) {
+                METRIC_ADD(errors, 1);
+                c->state = CONN_DONE;
+            }
+        } else {
+            METRIC_ADD(bytes_out, res);
+            size_t n = res;
+            while (n > 0 && c->out_idx < c->out_cnt) {
+                struct iovec* v = &c->out[c->out_idx];
+                if (n >= v->iov_len) {
+                    n -= v->iov_len;
+                    c->out_idx++;
                 } else {
-                    if (i > maxi) maxi = i;
-                    snprintf(buf, sizeof(buf), "[poll] accepted connfd=%d into client[%d]", connfd, i);
-                    echo_servidor(buf);
+                    v->iov_base = (char*)v->iov_base + n;
+                    v->iov_len -= n;
+                    n = 0;
                 }
             }
-            if (--nready <= 0) continue;
         }
+        /* out[] enviado: conn_on_writable cuida do arquivo e da volta para
+         * a leitura (ou do fim); um request já no buffer é tratado já */
+        if (c->state == CONN_WRITING && c->out_idx == c->out_cnt) {
+            conn_on_writable(c);
+            if (c->state == CONN_READING_HEADERS && c->in_len > 0) conn_parse(c);
+        }
+    } else if (tag == UR_POLL) {
+        if (c->state == CONN_WRITING) {
+            conn_on_writable(c);
+            if (c->state == CONN_READING_HEADERS && c->in_len > 0) conn_parse(c);
+        }
+    }
+    uring_settle(u, c);
+}
+
+/* server_with_uring: laço do modo 6; devolve -1 se o kernel não tem o
+ * io_uring necessário (nada foi alterado no listenfd) */
+int server_with_uring(int listenfd, int sleep_time) {
+    struct uring u;
+    struct conn_table table;
+    struct conn_timers timers;
+    if (uring_init(&u) < 0) return -1;
+
+    conn_timers_init(&timers, sleep_time);
+    conn_table_init(&table, config.max_conns);
+    uring_accept_gate(&u, listenfd, &table);
+    log_msg(LOG_SERVER, "[uring] pid=%d modo io_uring iniciado (listenfd=%d, %u buffers de %d bytes)",
+            (int)getpid(), listenfd, UR_NBUFS, UR_BUF_SIZE);
+
+    for (;;) {
+        store_sync();
+        int ret = uring_submit(&u, 1, conn_timers_timeout(&timers));
+        if (ret < 0 && errno != EINTR && errno != ETIME && errno != EBUSY) {
+            perror("io_uring_enter");
+            break;
+        }
+        long now = now_ms();
+        date_tick(now);
+
+        unsigned head = *u.cq_head;
+        unsigned tail = __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &u.cqes[head & u.cq_mask];
+            unsigned long ud = cqe->user_data;
+            int tag = ud & UR_TAG_MASK;
+            struct conn* c = (struct conn*)(ud & ~(unsigned long)UR_TAG_MASK);
 
-        for (i = 1; i <= maxi; i++) {
-            if (clients[i].fd < 0) continue;
-            if (clients[i].revents & (POLLRDNORM | POLLERR)) {
-                sockfd = clients[i].fd;
-                snprintf(buf, sizeof(buf), "[poll] pid=%d handling connfd=%d (client[%d])", (int)getpid(), sockfd, i);
-                echo_servidor(buf);
-                process_request(sockfd, sleep_time);
-                Close(sockfd);
-                clients[i].fd = -1;
-                if (--nready <= 0) break;
+            if (tag == UR_CANCEL) continue;
+            if (tag == UR_ACCEPT) {
+                if (cqe->res >= 0) {
+                    METRIC_ADD(accepted, 1);
+                    struct conn* nc = conn_new(cqe->res, &timers, &table);
+                    if (nc == NULL) {
+                        log_msg(LOG_SERVER, "[uring] out of memory, closing new conn");
+                        Close_unserved(cqe->res);
+                    } else {
+                        log_msg(LOG_CONN, "[uring] accepted connfd=%d", cqe->res);
+                        uring_settle(&u, nc);
+                    }
+                } else if (cqe->res == -EMFILE || cqe->res == -ENFILE) {
+                    METRIC_ADD(accept_errors, 1);
+                    errno = -cqe->res;
+                    accept_starved(&table);
+                } else if (cqe->res != -EINTR && cqe->res != -EAGAIN && cqe->res != -ECONNABORTED
+                           && cqe->res != -ECANCELED) {
+                    METRIC_ADD(accept_errors, 1);
+                }
+                /* sem F_MORE o accept acabou; o gate decide se submete outro
+                 * e, com o multishot ativo, se ele precisa ser cancelado */
+                if (!(cqe->flags & IORING_CQE_F_MORE)) u.accept_armed = 0;
+                uring_accept_gate(&u, listenfd, &table);
+                continue;
             }
+            uring_complete(&u, c, tag, cqe->res, cqe->flags);
+        }
+        __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+
+        /* prazos vencidos (ver enum timer_kind) */
+        struct conn* c;
+        while ((c = conn_timers_expire(&timers, now)) != NULL) uring_settle(&u, c);
+
+        uring_accept_gate(&u, listenfd, &table);
+    }
+    return 0;
+}
+
+/* ------------------ Modo 0: fork e pool pré-forkado ------------------ */
+
+/* servidor concorrente com um fork() por conexão (original) */
+void server_with_fork(int listenfd, int sleep_time) {
+    int connfd;
+    for (;;) {
+        store_sync();
+        if ((connfd = Accept(listenfd)) < 0) {
+            if (errno != EINTR) perror("accept error");
+            continue;
+        }
+
+        pid_t pid;
+        if ((pid = Fork()) == 0) {
+          /* child */
+          Close(listenfd);
+          metrics_use(0);   /* filhos de vida curta somam no slot compartilhado */
+          log_msg(LOG_CONN, "[fork] pid=%d handling connfd=%d", (int)getpid(), connfd);
+          process_request(connfd, sleep_time);
+          Close(connfd);
+          METRIC_ADD(closed, 1);
+          exit(0);
         }
+        /* parent */
+        Close(connfd);
     }
+}
+
+/* pedido de saída enviado pelo supervisor (SIGUSR1) a um filho ocioso */
+static volatile sig_atomic_t prefork_quit = 0;
 
-    free(clients);
+static void sig_prefork_quit(int signo) {
+    (void)signo;
+    prefork_quit = 1;
 }
 
-/* servidor que trata TCP e UDP com select() no mesmo processo */
-void server_tcp_udp_select(int listenfd, int udpfd, int sleep_time) {
-    int maxfd, i;
-    int clients[FD_SETSIZE];
-    fd_set allset, rset;
+/* SIGCHLD no supervisor só serve para interromper o nanosleep */
+static void sig_wakeup(int signo) {
+    (void)signo;
+}
 
-    for (i = 0; i < FD_SETSIZE; i++) clients[i] = -1;
+/* prefork_child: laço de um filho do pool; espera o listenfd compartilhado
+ * num epoll próprio com EPOLLEXCLUSIVE (o kernel acorda um único filho por
+ * conexão) e então faz o accept, que não bloqueia: outro filho pode ter
+ * levado a conexão */
+static void prefork_child(struct worker_slot* slot, pid_t supervisor, int listenfd, int sleep_time) {
+    /* o pool morre junto com o supervisor */
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != supervisor) exit(0);
 
-    FD_ZERO(&allset);
-    FD_SET(listenfd, &allset);
-    FD_SET(udpfd, &allset);
-    maxfd = (listenfd > udpfd) ? listenfd : udpfd;
+    /* SIGUSR1 fica bloqueado e só é entregue dentro do epoll_pwait, que
+     * troca a máscara e espera de forma atômica: um pedido de saída que
+     * chega depois do teste de prefork_quit interrompe a espera em vez de
+     * ficar pendente até a próxima conexão, e nunca interrompe um request
+     * em andamento */
+    sigset_t quitset, waitmask;
+    sigemptyset(&quitset);
+    sigaddset(&quitset, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &quitset, &waitmask);
+    sigdelset(&waitmask, SIGUSR1);
 
-    char buf[256];
-    snprintf(buf, sizeof(buf), "[tcp+udp select] pid=%d iniciado (tcp=%d udp=%d)",
-             (int)getpid(), listenfd, udpfd);
-    echo_servidor(buf);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE };
+    if (epfd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+        perror("epoll prefork");
+        exit(1);
+    }
 
-    for (;;) {
-        rset = allset;
-        int nready = select(maxfd + 1, &rset, NULL, NULL, NULL);
-        if (nready < 0) {
-            if (errno == EINTR) continue;
-            perror("select");
-            break;
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = sig_prefork_quit;
+    sigemptyset(&act.sa_mask);
+    sigaction(SIGUSR1, &act, NULL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_IGN);    /* recarga do store é com o supervisor */
+
+    while (!prefork_quit) {
+        __atomic_store_n(&slot->state, SLOT_IDLE, __ATOMIC_RELEASE);
+        if (epoll_pwait(epfd, &ev, 1, -1, &waitmask) < 0) {
+            if (errno != EINTR) perror("epoll_pwait");
+            continue;
+        }
+        int connfd = Accept(listenfd);
+        if (connfd < 0) {
+            if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept error");
+            continue;
+        }
+
+        __atomic_store_n(&slot->state, SLOT_BUSY, __ATOMIC_RELEASE);
+        log_msg(LOG_CONN, "[prefork] pid=%d handling connfd=%d", (int)getpid(), connfd);
+        process_request(connfd, sleep_time);
+        Close(connfd);
+        METRIC_ADD(closed, 1);
+        slot->served++;
+    }
+    exit(0);
+}
+
+/* prefork_spawn: cria um filho em um slot livre; retorna 0 em sucesso */
+static int prefork_spawn(struct worker_slot* slots, int nslots, int listenfd, int sleep_time) {
+    pid_t supervisor = getpid();
+    for (int i = 0; i < nslots; i++) {
+        if (slots[i].state != SLOT_FREE) continue;
+        slots[i].state = SLOT_STARTING;
+        slots[i].quitting = 0;
+        slots[i].served = 0;
+        pid_t pid = Fork();
+        if (pid == 0) {
+            /* o substituto continua a contagem do filho anterior do slot */
+            metrics_use(1 + i);
+            prefork_child(&slots[i], supervisor, listenfd, sleep_time);
+        } else if (pid < 0) {
+            slots[i].state = SLOT_FREE;
+            return -1;
         }
+        slots[i].pid = pid;
+        return 0;
+    }
+    return -1;
+}
+
+/* servidor com pool pré-forkado (estilo Apache prefork)
+ *
+ * O supervisor cria config.prefork filhos de uma vez e depois, a cada
+ * segundo (ou quando um filho morre), ajusta o pool olhando o scoreboard
+ * em memória compartilhada: recria filhos mortos, cria mais se houver
+ * menos de min_spare ociosos e dispensa um ocioso por rodada se houver
+ * mais de max_spare, respeitando max_children. */
+void server_with_prefork(int listenfd, int sleep_time) {
+    int nslots = config.max_children;
+    if (nslots < config.prefork) nslots = config.prefork;
+
+    struct worker_slot* slots = mmap(NULL, nslots * sizeof(struct worker_slot),
+                                     PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        perror("mmap scoreboard");
+        exit(1);
+    }
+    for (int i = 0; i < nslots; i++) slots[i].state = SLOT_FREE;
+
+    /* o supervisor colhe os filhos ele mesmo, sem o log do sig_chld */
+    Signal(SIGCHLD, sig_wakeup);
+
+    log_msg(LOG_SERVER, "[prefork] pid=%d supervisor: %d filhos (min_spare=%d max_spare=%d max_children=%d)",
+            (int)getpid(), config.prefork, config.min_spare, config.max_spare, nslots);
+
+    /* os filhos esperam no epoll e o accept não pode bloquear quem perdeu
+     * a conexão para outro (o socket aceito continua bloqueante) */
+    set_nonblocking(listenfd);
+    for (int i = 0; i < config.prefork; i++)
+        prefork_spawn(slots, nslots, listenfd, sleep_time);
+
+    for (;;) {
+        struct timespec ts = { .tv_sec = 1, .tv_nsec = 0 };
+        nanosleep(&ts, NULL);
 
-        /* UDP datagram available? */
-        if (FD_ISSET(udpfd, &rset)) {
-            char databuf[MAXLINE+1];
-            struct sockaddr_in cliaddr; socklen_t clilen = sizeof(cliaddr);
-            ssize_t n = recvfrom(udpfd, databuf, MAXLINE, 0, (struct sockaddr*)&cliaddr, &clilen);
-            if (n > 0) {
-                databuf[n] = '\0';
-                snprintf(buf, sizeof(buf), "[UDP] from %s:%d -> %s",
-                         inet_ntoa(cliaddr.sin_addr), ntohs(cliaddr.sin_port), databuf);
-                echo_servidor(buf);
-                if (sleep_time > 0) sleep(sleep_time);
-                const char *resp = "HTTP/1.0 200 OK\r\nContent-Length: 2\r\n\r\nOK";
-                sendto(udpfd, resp, strlen(resp), 0, (struct sockaddr*)&cliaddr, clilen);
+        /* store recarregado: os filhos têm a cópia antiga, então todos são
+         * dispensados (os ocupados saem ao terminar o request corrente) e
+         * os substitutos herdam o novo */
+        if (store_sync()) {
+            for (int i = 0; i < nslots; i++) {
+                if (slots[i].state == SLOT_FREE || slots[i].quitting) continue;
+                slots[i].quitting = 1;
+                kill(slots[i].pid, SIGUSR1);
             }
-            if (--nready <= 0) continue;
+            for (int i = 0; i < config.prefork; i++)
+                if (prefork_spawn(slots, nslots, listenfd, sleep_time) < 0) break;
         }
 
-        /* new TCP connection? */
-        if (FD_ISSET(listenfd, &rset)) {
-            int connfd = Accept(listenfd);
-            if (connfd >= 0) {
-                for (i = 0; i < FD_SETSIZE; i++) {
-                    if (clients[i] < 0) {
-                        clients[i] = connfd;
-                        break;
-                    }
-                }
-                if (i == FD_SETSIZE) {
-                    echo_servidor("[tcp+udp] too many clients");
-                    Close(connfd);
-                } else {
-                    FD_SET(connfd, &allset);
-                    if (connfd > maxfd) maxfd = connfd;
-                    snprintf(buf, sizeof(buf), "[tcp+udp] accepted connfd=%d stored at clients[%d]", connfd, i);
-                    echo_servidor(buf);
+        pid_t pid;
+        int stat;
+        while ((pid = waitpid(-1, &stat, WNOHANG)) > 0) {
+            for (int i = 0; i < nslots; i++) {
+                if (slots[i].pid != pid || slots[i].state == SLOT_FREE) continue;
+                if (!(WIFEXITED(stat) && WEXITSTATUS(stat) == 0)) {
+                    log_msg(LOG_SERVER, "[prefork] filho pid=%d morreu (status=%d), recriando", (int)pid, stat);
                 }
+                slots[i].state = SLOT_FREE;
+                slots[i].pid = 0;
+                break;
+            }
+        }
+
+        int idle = 0, total = 0, victim = -1;
+        for (int i = 0; i < nslots; i++) {
+            int st = __atomic_load_n(&slots[i].state, __ATOMIC_ACQUIRE);
+            if (st == SLOT_FREE) continue;
+            total++;
+            if (st == SLOT_IDLE || st == SLOT_STARTING) {
+                idle++;
+                if (st == SLOT_IDLE && !slots[i].quitting) victim = i;
             }
-            if (--nready <= 0) continue;
         }
 
-        /* existing TCP client data */
-        for (i = 0; i < FD_SETSIZE; i++) {
-            int sockfd = clients[i];
-            if (sockfd < 0) continue;
-            if (FD_ISSET(sockfd, &rset)) {
-                snprintf(buf, sizeof(buf), "[tcp+udp select] pid=%d handling connfd=%d (clients[%d])",
-                         (int)getpid(), sockfd, i);
-                echo_servidor(buf);
-                process_request(sockfd, sleep_time);
-                Close(sockfd);
-                FD_CLR(sockfd, &allset);
-                clients[i] = -1;
-                if (--nready <= 0) break;
+        if (total < config.prefork || idle < config.min_spare) {
+            int want = config.min_spare - idle;
+            if (want < config.prefork - total) want = config.prefork - total;
+            while (want-- > 0 && total < nslots) {
+                if (prefork_spawn(slots, nslots, listenfd, sleep_time) < 0) break;
+                total++;
             }
+        } else if (idle > config.max_spare && total > config.prefork && victim >= 0) {
+            slots[victim].quitting = 1;
+            kill(slots[victim].pid, SIGUSR1);
+        }
+    }
+}
+
+/* ------------------------- opções extras ---------------------------- */
+
+/* tabela das opções chave=valor aceitas na linha de comando */
+static const struct {
+    const char* name;
+    int* value;
+    const char** str;   /* opções de texto (value == NULL) */
+} options[] = {
+    { "workers",      &config.workers, NULL },
+    { "pin_cpu",      &config.pin_cpu, NULL },
+    { "prefork",      &config.prefork, NULL },
+    { "min_spare",    &config.min_spare, NULL },
+    { "max_spare",    &config.max_spare, NULL },
+    { "max_children", &config.max_children, NULL },
+    { "keepalive_timeout", &config.keepalive_timeout, NULL },
+    { "header_timeout",    &config.header_timeout, NULL },
+    { "write_timeout",     &config.write_timeout, NULL },
+    { "keepalive_max",     &config.keepalive_max, NULL },
+    { "max_conns",         &config.max_conns, NULL },
+    { "simd",              &config.simd, NULL },
+    { "date",              &config.date, NULL },
+    { "root",              NULL, &config.root },
+    { "file_cache",        &config.file_cache, NULL },
+    { "store_max",         &config.store_max, NULL },
+    { "log_level",         &config.log_level, NULL },
+    { "log_sample",        &config.log_sample, NULL },
+    { "metrics",           &config.metrics, NULL },
+    { "udp_batch",         &config.udp_batch, NULL },
+    { "udp_workers",       &config.udp_workers, NULL },
+    { "udp_offload",       &config.udp_offload, NULL },
+    { "tls",               &config.tls, NULL },
+    { "tls_cert",          NULL, &config.tls_cert },
+    { "tls_key",           NULL, &config.tls_key },
+    { "tls_tickets",       &config.tls_tickets, NULL },
+    { "ktls",              &config.ktls, NULL },
+    { "upstream",          NULL, &config.upstream },
+    { "proxy",             NULL, &config.proxy },
+    { "proxy_pool",        &config.proxy_pool, NULL },
+    { "proxy_splice",      &config.proxy_splice, NULL },
+};
+
+/* parse_options: lê argumentos extras no formato chave=valor
+ * (a partir de argv[first]); ver struct server_config */
+void parse_options(int argc, char** argv, int first) {
+    for (int i = first; i < argc; i++) {
+        char* eq = strchr(argv[i], '=');
+        if (eq == NULL) {
+            fprintf(stderr, "opção inválida '%s' (esperado chave=valor)\n", argv[i]);
+            exit(1);
         }
+        size_t klen = eq - argv[i];
+        size_t k;
+        for (k = 0; k < sizeof(options) / sizeof(options[0]); k++) {
+            if (strlen(options[k].name) == klen && strncmp(argv[i], options[k].name, klen) == 0)
+                break;
+        }
+        if (k == sizeof(options) / sizeof(options[0])) {
+            fprintf(stderr, "opção desconhecida '%.*s'\n", (int)klen, argv[i]);
+            exit(1);
+        }
+        if (options[k].str) *options[k].str = eq + 1;
+        else *options[k].value = atoi(eq + 1);
     }
 }
 
 /* --------------------------- main ----------------------------------- */
 
+/* bench_http.c inclui este arquivo com SERVER_HTTP_NO_MAIN para medir as
+ * rotinas internas sem subir o servidor */
+#ifndef SERVER_HTTP_NO_MAIN
+
 int main(int argc, char **argv) {
-    int listenfd, connfd;
+    int listenfd;
     int porta = 0;
     if (argc > 1) porta = atoi(argv[1]);
 
@@ -477,14 +5688,37 @@ int main(int argc, char **argv) {
     int mode = 0;
     if (argc > 4) mode = atoi(argv[4]);
 
+    parse_options(argc, argv, 5);
+    log_init();
+    scan_init();
+    routes_init();
+    files_init();
+    store_init();
+    metrics_init(mode);
+    if (config.tls && mode == 0) {
+        fprintf(stderr, "tls=1 precisa de um modo orientado a eventos (1 a 6)\n");
+        exit(1);
+    }
+    if (config.upstream && (mode < 4 || mode > 6)) {
+        fprintf(stderr, "upstream= precisa de um modo com epoll (4 a 6)\n");
+        exit(1);
+    }
+    proxy_init();
+    tls_init();
+    fd_limit_init(mode == 5 ? reactor_count() : 1);
+
     listenfd = Socket();
     Setsocketopt(listenfd);
+    if (mode == 5) Setsocketopt_reuseport(listenfd);
     Bind(listenfd, porta);
     log_server_info(listenfd);
     Listen(listenfd, backlog);
+    log_msg(LOG_SERVER, "varredura de headers: %s", scan->name);
 
     /* handle SIGCHLD only if using fork mode; harmless otherwise */
     Signal(SIGCHLD, sig_chld);
+    /* cliente que fecha antes da resposta vira EPIPE em vez de matar o servidor */
+    Signal(SIGPIPE, SIG_IGN);
 
     /* escolha do modo */
     if (mode == 1) {
@@ -499,6 +5733,7 @@ int main(int argc, char **argv) {
         if (udpfd < 0) { perror("socket udp"); exit(1); }
         /* permitir reutilizar endereco */
         Setsocketopt(udpfd);
+        if (config.udp_workers > 0) Setsocketopt_reuseport(udpfd);
         struct sockaddr_in servaddr;
         memset(&servaddr, 0, sizeof(servaddr));
         servaddr.sin_family = AF_INET;
@@ -516,35 +5751,40 @@ int main(int argc, char **argv) {
             close(udpfd);
             exit(1);
         }
-        server_tcp_udp_select(listenfd, udpfd, sleep_time);
+        if (config.udp_workers > 0) {
+            /* UDP nas próprias threads; o select fica só com o TCP */
+            udp_start_workers(udpfd, sleep_time);
+            server_tcp_udp_select(listenfd, -1, sleep_time);
+        } else {
+            server_tcp_udp_select(listenfd, udpfd, sleep_time);
+        }
         close(udpfd);
         return 0;
-    }
-
-    /* modo default: servidor concorrente com fork (original) */
-    for (;;) {
-        if ((connfd = Accept(listenfd)) < 0) {
-            if (errno == EINTR)
-                continue;
-            else
-                perror("accept error");
-        }
-
-        pid_t pid;
-        if ((pid = Fork()) == 0) {
-          /* child */
-          Close(listenfd);
-          char buf[128];
-          snprintf(buf, sizeof(buf), "[fork] pid=%d handling connfd=%d", (int)getpid(), connfd);
-          echo_servidor(buf);
-          process_request(connfd, sleep_time);
-          Close(connfd);
-          exit(0);
+    } else if (mode == 4) {
+        server_with_epoll(listenfd, sleep_time);
+        return 0;
+    } else if (mode == 5) {
+        server_with_reuseport(listenfd, backlog, sleep_time);
+        return 0;
+    } else if (mode == 6) {
+        if (config.tls || config.upstream) {
+            /* o io_uring lê e escreve sem passar pelo SSL nem pelo proxy */
+            echo_servidor("[uring] tls=1/upstream=: usando epoll");
+            server_with_epoll(listenfd, sleep_time);
+        } else if (server_with_uring(listenfd, sleep_time) < 0) {
+            perror("[uring] io_uring indisponível, usando epoll");
+            server_with_epoll(listenfd, sleep_time);
         }
-        /* parent */
-        Close(connfd);
+        return 0;
     }
 
+    /* modo default: pool pré-forkado (prefork=0 volta ao fork por conexão) */
+    if (config.prefork > 0)
+        server_with_prefork(listenfd, sleep_time);
+    else
+        server_with_fork(listenfd, sleep_time);
+
     return 0;
 }
 
+#endif /* SERVER_HTTP_NO_MAIN */